@@ -0,0 +1,410 @@
+/**********************************************************************
+ * Copyright (c) 2020
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "process.h"
+#include "gang.h"
+
+extern bool quiet;
+
+/***********************************************************************
+ * Parallel jobs on multiple CPUs
+ *
+ * A job is a process with @threads threads, and each thread should run
+ * @lifespan ticks. The threads synchronize at the end of every tick as if
+ * they meet at a barrier; a thread can make its k+1-th tick of progress
+ * only after all its siblings have made k ticks. A thread dispatched while
+ * a sibling lags behind spins on the barrier without making a progress.
+ *
+ * Resources are not simulated on the multiple CPUs.
+ ***********************************************************************/
+#define MAX_SLOTS	64	/* Maximum number of rows in the Ousterhout matrix */
+
+struct job {
+	struct process *process;
+	int nr_threads;
+	unsigned int progress[MAX_CPUS];	/* Ticks made by each thread */
+	unsigned int barrier;				/* Progress all threads have made */
+	bool forked;
+	bool done;
+	unsigned int exited_at;
+};
+
+struct thread {
+	int job;
+	int thread;
+};
+
+struct result {
+	unsigned int makespan;
+	unsigned long turnaround;
+	unsigned long busy;		/* CPU ticks making a progress */
+	unsigned long spin;		/* CPU ticks spinning on the barrier */
+	unsigned long idle;		/* CPU ticks left unused */
+};
+
+static struct job *jobs = NULL;
+static int nr_jobs = 0;
+static int nr_cpus = 1;
+
+
+static void __reset_jobs(void)
+{
+	for (int i = 0; i < nr_jobs; i++) {
+		struct job *j = jobs + i;
+		memset(j->progress, 0x00, sizeof(j->progress));
+		j->barrier = 0;
+		j->forked = j->done = false;
+		j->exited_at = 0;
+	}
+}
+
+static int __nr_live_jobs(void)
+{
+	int nr = 0;
+	for (int i = 0; i < nr_jobs; i++) {
+		if (!jobs[i].done) nr++;
+	}
+	return nr;
+}
+
+/**
+ * Run thread @t of job @j in this tick. Return true if it makes a progress
+ */
+static bool __run_thread(struct job *j, int t)
+{
+	if (j->progress[t] > j->barrier) return false;
+
+	j->progress[t]++;
+	return true;
+}
+
+/**
+ * Move the barriers after a tick and retire the completed jobs.
+ * Return the number of jobs that exited in this tick.
+ */
+static int __sync_jobs(unsigned int ticks, struct result *result)
+{
+	int nr_exited = 0;
+
+	for (int i = 0; i < nr_jobs; i++) {
+		struct job *j = jobs + i;
+		unsigned int barrier = j->process->lifespan;
+
+		if (!j->forked || j->done) continue;
+
+		for (int t = 0; t < j->nr_threads; t++) {
+			if (j->progress[t] < barrier) barrier = j->progress[t];
+		}
+		j->barrier = barrier;
+
+		if (barrier == j->process->lifespan) {
+			j->done = true;
+			j->exited_at = ticks + 1;
+			result->turnaround += j->exited_at - j->process->__starts_at;
+			nr_exited++;
+		}
+	}
+	return nr_exited;
+}
+
+/* Width of a CPU column: the thread name right-aligned and the spin mark */
+#define CELL_WIDTH	8
+
+static void __print_cpu(struct job *j, int t, bool progress)
+{
+	char name[16] = "-";
+
+	if (quiet) return;
+
+	if (j) snprintf(name, sizeof(name), "%d.%d", j->process->pid, t);
+	fprintf(stderr, " %*s%c", CELL_WIDTH - 2, name, j && !progress ? '~' : ' ');
+}
+
+
+/***********************************************************************
+ * Gang scheduler with the Ousterhout matrix
+ *
+ * Each row of the matrix is a time slot and each column is a CPU. A job
+ * is placed in the first row that has as many free columns as its threads,
+ * or in a new row if no row has. The rows take turns tick by tick, and all
+ * the threads in a row are dispatched together. The free columns in the
+ * running row are the fragmentation.
+ *
+ * Both schedulers account every CPU in every tick as busy, spinning, or
+ * idle, so the three add up to the makespan times the CPUs.
+ ***********************************************************************/
+struct cell {
+	int job;			/* -1 if the cell is free */
+	int thread;
+};
+
+static struct cell matrix[MAX_SLOTS][MAX_CPUS];
+static int nr_slots = 0;
+
+static int __nr_free_cells(int slot)
+{
+	int nr = 0;
+	for (int c = 0; c < nr_cpus; c++) {
+		if (matrix[slot][c].job < 0) nr++;
+	}
+	return nr;
+}
+
+static void __clear_slot(int slot)
+{
+	for (int c = 0; c < nr_cpus; c++) {
+		matrix[slot][c].job = -1;
+	}
+}
+
+static bool __place_job(int job)
+{
+	struct job *j = jobs + job;
+	int slot;
+	int t = 0;
+
+	for (slot = 0; slot < nr_slots; slot++) {
+		if (__nr_free_cells(slot) >= j->nr_threads) break;
+	}
+	if (slot == nr_slots) {
+		if (nr_slots == MAX_SLOTS) return false;
+		__clear_slot(nr_slots++);
+	}
+
+	for (int c = 0; c < nr_cpus && t < j->nr_threads; c++) {
+		if (matrix[slot][c].job >= 0) continue;
+		matrix[slot][c].job = job;
+		matrix[slot][c].thread = t++;
+	}
+	return true;
+}
+
+/**
+ * Free the cells of the exited jobs and drop the empty rows. Return the
+ * index of the row to run next after @slot.
+ */
+static int __compact_matrix(int slot)
+{
+	int next = slot + 1;
+
+	for (int s = 0; s < nr_slots; s++) {
+		for (int c = 0; c < nr_cpus; c++) {
+			struct cell *cell = &matrix[s][c];
+			if (cell->job >= 0 && jobs[cell->job].done) cell->job = -1;
+		}
+	}
+
+	for (int s = 0; s < nr_slots; ) {
+		if (__nr_free_cells(s) < nr_cpus) {
+			s++;
+			continue;
+		}
+		memmove(matrix[s], matrix[s + 1], sizeof(matrix[0]) * (nr_slots - s - 1));
+		nr_slots--;
+		if (s < next) next--;
+	}
+	return nr_slots ? next % nr_slots : 0;
+}
+
+static void __simulate_gang(struct result *result)
+{
+	unsigned int ticks = 0;
+	int slot = 0;
+
+	nr_slots = 0;
+
+	while (__nr_live_jobs()) {
+		/* Fork the jobs arriving at this tick into the matrix */
+		for (int i = 0; i < nr_jobs; i++) {
+			struct job *j = jobs + i;
+			if (j->forked || j->process->__starts_at > ticks) continue;
+			if (!__place_job(i)) continue;	/* Retry when a row is freed */
+			j->forked = true;
+		}
+
+		if (!quiet) fprintf(stderr, "%3d:", ticks);
+
+		if (nr_slots) {
+			result->idle += __nr_free_cells(slot);
+
+			if (!quiet) fprintf(stderr, " [%2d]", slot);
+			for (int c = 0; c < nr_cpus; c++) {
+				struct cell *cell = &matrix[slot][c];
+				bool progress = false;
+
+				if (cell->job < 0) {
+					__print_cpu(NULL, 0, false);
+					continue;
+				}
+				progress = __run_thread(jobs + cell->job, cell->thread);
+				if (progress) {
+					result->busy++;
+				} else {
+					result->spin++;
+				}
+				__print_cpu(jobs + cell->job, cell->thread, progress);
+			}
+		} else {
+			result->idle += nr_cpus;
+			if (!quiet) fprintf(stderr, " idle");
+		}
+		if (!quiet) fprintf(stderr, "\n");
+
+		__sync_jobs(ticks, result);
+		slot = nr_slots ? __compact_matrix(slot) : 0;
+		ticks++;
+	}
+	result->makespan = ticks;
+}
+
+
+/***********************************************************************
+ * Uncoordinated scheduler
+ *
+ * The threads are dispatched independently in round robin; the first
+ * @nr_cpus threads in the queue run and go to the tail of the queue.
+ ***********************************************************************/
+static void __simulate_uncoordinated(struct result *result)
+{
+	unsigned int ticks = 0;
+	struct thread *queue;
+	int nr_queued = 0;
+
+	queue = malloc(sizeof(*queue) * nr_jobs * MAX_CPUS);
+
+	while (__nr_live_jobs()) {
+		int nr_running;
+		struct thread running[MAX_CPUS];
+
+		for (int i = 0; i < nr_jobs; i++) {
+			struct job *j = jobs + i;
+			if (j->forked || j->process->__starts_at > ticks) continue;
+			for (int t = 0; t < j->nr_threads; t++) {
+				queue[nr_queued++] = (struct thread) { .job = i, .thread = t };
+			}
+			j->forked = true;
+		}
+
+		if (!quiet) fprintf(stderr, "%3d:", ticks);
+
+		nr_running = nr_queued < nr_cpus ? nr_queued : nr_cpus;
+		memcpy(running, queue, sizeof(*running) * nr_running);
+		memmove(queue, queue + nr_running, sizeof(*queue) * (nr_queued - nr_running));
+		nr_queued -= nr_running;
+
+		result->idle += nr_cpus - nr_running;
+
+		for (int c = 0; c < nr_cpus; c++) {
+			struct job *j;
+			bool progress;
+
+			if (c >= nr_running) {
+				__print_cpu(NULL, 0, false);
+				continue;
+			}
+			j = jobs + running[c].job;
+			progress = __run_thread(j, running[c].thread);
+			if (progress) {
+				result->busy++;
+			} else {
+				result->spin++;
+			}
+			__print_cpu(j, running[c].thread, progress);
+		}
+		if (!quiet) fprintf(stderr, "\n");
+
+		__sync_jobs(ticks, result);
+
+		/* Put back the threads that have more ticks to run */
+		for (int i = 0; i < nr_running; i++) {
+			struct job *j = jobs + running[i].job;
+			if (j->progress[running[i].thread] == j->process->lifespan) continue;
+			queue[nr_queued++] = running[i];
+		}
+		ticks++;
+	}
+	result->makespan = ticks;
+
+	free(queue);
+}
+
+
+static void __print_result(const char *name, struct result *result)
+{
+	unsigned long cpu_ticks = (unsigned long)result->makespan * nr_cpus;
+
+	assert(result->busy + result->spin + result->idle == cpu_ticks);
+
+	printf("%-16s %10d %12.2f %10.1f%% %10lu %10lu %10lu %10.1f%%\n", name,
+			result->makespan, (double)result->turnaround / nr_jobs,
+			cpu_ticks ? 100.0 * result->busy / cpu_ticks : 0,
+			result->busy, result->spin, result->idle,
+			cpu_ticks ? 100.0 * result->idle / cpu_ticks : 0);
+}
+
+int run_gang(struct list_head *processes, int cpus)
+{
+	struct process *p;
+	struct result gang = { 0 }, uncoordinated = { 0 };
+
+	if (cpus < 1 || cpus > MAX_CPUS) {
+		fprintf(stderr, "The number of CPUs should be 1 to %d\n", MAX_CPUS);
+		return EXIT_FAILURE;
+	}
+	nr_cpus = cpus;
+
+	list_for_each_entry(p, processes, list) {
+		nr_jobs++;
+	}
+	jobs = calloc(nr_jobs, sizeof(*jobs));
+
+	nr_jobs = 0;
+	list_for_each_entry(p, processes, list) {
+		struct job *j = jobs + nr_jobs++;
+
+		j->process = p;
+		if (p->threads > (unsigned int)nr_cpus) {
+			fprintf(stderr, "Process %d has more threads than CPUs\n", p->pid);
+			return EXIT_FAILURE;
+		}
+		j->nr_threads = p->threads;
+	}
+
+	fflush(stdout);
+
+	if (!quiet) fprintf(stderr, "Gang scheduling\n");
+	__reset_jobs();
+	__simulate_gang(&gang);
+
+	if (!quiet) fprintf(stderr, "\nUncoordinated scheduling\n");
+	__reset_jobs();
+	__simulate_uncoordinated(&uncoordinated);
+
+	if (!quiet) fprintf(stderr, "\n");
+	printf("%-16s %10s %12s %11s %10s %10s %10s %11s\n", "Scheduler",
+			"Makespan", "Turnaround", "Util.", "Busy", "Spin", "Idle", "Frag.");
+	__print_result("Gang", &gang);
+	__print_result("Uncoordinated", &uncoordinated);
+
+	free(jobs);
+	return EXIT_SUCCESS;
+}
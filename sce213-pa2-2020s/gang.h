@@ -0,0 +1,38 @@
+/**********************************************************************
+ * Copyright (c) 2020
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __GANG_H__
+#define __GANG_H__
+
+#define MAX_CPUS	32	/* Maximum number of CPUs in the multi-CPU simulation */
+
+/***********************************************************************
+ * run_gang(@processes, @nr_cpus)
+ *
+ * DESCRIPTION
+ *   Simulate the parallel jobs in @processes, which are linked through
+ *   @list in the order of the script, on @nr_cpus CPUs. Each job runs its
+ *   @threads threads that synchronize every tick. The jobs are scheduled
+ *   by the gang scheduler with the Ousterhout matrix and by the
+ *   uncoordinated scheduler that dispatches the threads independently,
+ *   and the fragmentation of the CPUs under the two is compared.
+ *   @processes is not modified.
+ *
+ * RETURN VALUE
+ *   EXIT_SUCCESS on success, EXIT_FAILURE otherwise
+ */
+int run_gang(struct list_head *processes, int nr_cpus);
+
+#endif
@@ -0,0 +1,340 @@
+/**********************************************************************
+ * Copyright (c) 2020
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "process.h"
+#include "gang.h"
+#include "hetero.h"
+
+extern bool quiet;
+
+/***********************************************************************
+ * Processes on heterogeneous CPUs
+ *
+ * Each CPU has its speed, the amount of work it does per tick relative to
+ * the lifespan of the processes. A process on a CPU of speed 2 finishes
+ * a lifespan of 4 in two ticks, and one on a CPU of speed 0.5 in eight.
+ * A process runs on a CPU until it exits unless the placement migrates it.
+ *
+ * Resources and priorities are not simulated on the multiple CPUs.
+ ***********************************************************************/
+#define EPSILON		1e-9
+
+struct cpu {
+	double speed;
+	int task;			/* Index of the running task. -1 if idle */
+};
+
+struct task {
+	struct process *process;
+	double remaining;	/* Work left until the exit */
+	bool forked;
+	bool done;
+	unsigned int ran;	/* Ticks on any CPU */
+	unsigned int exited_at;
+};
+
+struct result {
+	unsigned int makespan;
+	unsigned long turnaround;
+	unsigned long waiting;
+	unsigned int migrations;
+	double work;		/* Work done by all the CPUs */
+};
+
+static struct cpu cpus[MAX_CPUS];
+static int nr_cpus = 0;
+
+static struct task *tasks = NULL;
+static int nr_tasks = 0;
+
+static int *queue = NULL;	/* Tasks waiting for a CPU in the arrival order */
+static int nr_queued = 0;
+
+
+/**
+ * Parse the comma-separated speeds in @config into @cpus
+ */
+static bool __parse_config(char *config)
+{
+	char *buffer = malloc(strlen(config) + 1);
+	char *token;
+
+	strcpy(buffer, config);
+
+	nr_cpus = 0;
+	for (token = strtok(buffer, ","); token; token = strtok(NULL, ",")) {
+		double speed = atof(token);
+
+		if (speed <= 0 || nr_cpus == MAX_CPUS) {
+			fprintf(stderr, "Invalid CPU configuration %s\n", config);
+			free(buffer);
+			return false;
+		}
+		cpus[nr_cpus++].speed = speed;
+	}
+	free(buffer);
+
+	if (!nr_cpus) {
+		fprintf(stderr, "Invalid CPU configuration %s\n", config);
+		return false;
+	}
+	return true;
+}
+
+static void __reset(void)
+{
+	for (int c = 0; c < nr_cpus; c++) {
+		cpus[c].task = -1;
+	}
+	for (int i = 0; i < nr_tasks; i++) {
+		struct task *t = tasks + i;
+		t->remaining = t->process->lifespan;
+		t->forked = t->done = false;
+		t->ran = t->exited_at = 0;
+	}
+	nr_queued = 0;
+}
+
+static void __dequeue(int index)
+{
+	memmove(queue + index, queue + index + 1, sizeof(*queue) * (nr_queued - index - 1));
+	nr_queued--;
+}
+
+static void __print_cpus(unsigned int ticks, bool migrated[])
+{
+	if (quiet) return;
+
+	fprintf(stderr, "%3d:", ticks);
+	for (int c = 0; c < nr_cpus; c++) {
+		if (cpus[c].task < 0) {
+			fprintf(stderr, "    -");
+		} else {
+			fprintf(stderr, " %3d%c", tasks[cpus[c].task].process->pid,
+					migrated[c] ? '>' : ' ');
+		}
+	}
+	fprintf(stderr, "\n");
+}
+
+
+/***********************************************************************
+ * Placement policies
+ *
+ * Capacity-oblivious placement gives the idle CPUs the waiting tasks in
+ * the arrival order, in the order of the CPUs.
+ *
+ * Capacity-aware placement groups the CPUs by their speeds, and gives the
+ * waiting tasks in the arrival order to the idle CPUs of the fastest
+ * group first, so the CPUs of the same speed get the tasks in the arrival
+ * order as the oblivious one does. Then it fixes the imbalance by
+ * migrating the tasks; a task on a slower CPU moves to an idle faster
+ * CPU, and the tasks on two CPUs are swapped if the one on the slower CPU
+ * has much more work left. Placing the longest first instead would only
+ * delay the short tasks on the CPUs of the same speed, and the long tasks
+ * stuck on slower CPUs are moved up by the migration anyway.
+ ***********************************************************************/
+static void __place_oblivious(bool migrated[], struct result *result)
+{
+	(void)migrated;
+	(void)result;
+
+	for (int c = 0; c < nr_cpus && nr_queued; c++) {
+		if (cpus[c].task >= 0) continue;
+		cpus[c].task = queue[0];
+		__dequeue(0);
+	}
+}
+
+static int __fastest_idle_cpu(void)
+{
+	int fastest = -1;
+
+	for (int c = 0; c < nr_cpus; c++) {
+		if (cpus[c].task >= 0) continue;
+		if (fastest < 0 || cpus[c].speed > cpus[fastest].speed) fastest = c;
+	}
+	return fastest;
+}
+
+static void __place_aware(bool migrated[], struct result *result)
+{
+	bool balanced;
+	int c;
+
+	/* Give the fastest idle CPU the task that came first */
+	while (nr_queued && (c = __fastest_idle_cpu()) >= 0) {
+		cpus[c].task = queue[0];
+		__dequeue(0);
+	}
+
+	/* Move up the tasks on slower CPUs to idle faster ones */
+	while ((c = __fastest_idle_cpu()) >= 0) {
+		int from = -1;
+
+		for (int i = 0; i < nr_cpus; i++) {
+			if (cpus[i].task < 0 || cpus[i].speed >= cpus[c].speed) continue;
+			if (from < 0 || tasks[cpus[i].task].remaining >
+					tasks[cpus[from].task].remaining + EPSILON) {
+				from = i;
+			}
+		}
+		if (from < 0) break;
+
+		cpus[c].task = cpus[from].task;
+		cpus[from].task = -1;
+		migrated[c] = true;
+		result->migrations++;
+	}
+
+	/**
+	 * Swap the tasks if the one on the slower CPU has more work left than
+	 * the faster CPU does in a tick, so that they do not ping-pong
+	 */
+	do {
+		balanced = true;
+		for (int big = 0; big < nr_cpus; big++) {
+			for (int little = 0; little < nr_cpus; little++) {
+				int tmp;
+
+				if (cpus[big].speed <= cpus[little].speed) continue;
+				if (cpus[big].task < 0 || cpus[little].task < 0) continue;
+				if (tasks[cpus[little].task].remaining <= tasks[cpus[big].task].remaining +
+						cpus[big].speed + EPSILON) continue;
+
+				tmp = cpus[big].task;
+				cpus[big].task = cpus[little].task;
+				cpus[little].task = tmp;
+				migrated[big] = migrated[little] = true;
+				result->migrations += 2;
+				balanced = false;
+			}
+		}
+	} while (!balanced);
+}
+
+static void __simulate(void (*place)(bool [], struct result *), struct result *result)
+{
+	unsigned int ticks = 0;
+	int nr_done = 0;
+
+	__reset();
+
+	while (nr_done < nr_tasks) {
+		bool migrated[MAX_CPUS] = { false };
+
+		for (int i = 0; i < nr_tasks; i++) {
+			struct task *t = tasks + i;
+			if (t->forked || t->process->__starts_at > ticks) continue;
+			t->forked = true;
+			queue[nr_queued++] = i;
+		}
+
+		place(migrated, result);
+		__print_cpus(ticks, migrated);
+
+		for (int c = 0; c < nr_cpus; c++) {
+			struct task *t;
+			double work;
+
+			if (cpus[c].task < 0) continue;
+
+			t = tasks + cpus[c].task;
+			work = t->remaining < cpus[c].speed ? t->remaining : cpus[c].speed;
+			t->remaining -= work;
+			t->ran++;
+			result->work += work;
+
+			if (t->remaining < EPSILON) {
+				t->done = true;
+				t->exited_at = ticks + 1;
+				result->turnaround += t->exited_at - t->process->__starts_at;
+				result->waiting += t->exited_at - t->process->__starts_at - t->ran;
+				cpus[c].task = -1;
+				nr_done++;
+			}
+		}
+		ticks++;
+	}
+	result->makespan = ticks;
+}
+
+static void __print_result(const char *config, const char *name, struct result *result)
+{
+	double capacity = 0;
+
+	for (int c = 0; c < nr_cpus; c++) {
+		capacity += cpus[c].speed;
+	}
+
+	printf("%-16s %-10s %10d %12.2f %10.2f %10.1f%% %10d\n", config, name,
+			result->makespan, (double)result->turnaround / nr_tasks,
+			(double)result->waiting / nr_tasks,
+			100.0 * result->work / (capacity * result->makespan),
+			result->migrations);
+}
+
+int run_hetero(struct list_head *processes, char *configs[], int nr_configs)
+{
+	struct process *p;
+	struct result results[nr_configs][2];
+	int ret = EXIT_FAILURE;
+
+	list_for_each_entry(p, processes, list) {
+		nr_tasks++;
+	}
+	tasks = calloc(nr_tasks, sizeof(*tasks));
+	queue = malloc(sizeof(*queue) * (nr_tasks + 1));
+
+	nr_tasks = 0;
+	list_for_each_entry(p, processes, list) {
+		tasks[nr_tasks++].process = p;
+	}
+
+	fflush(stdout);
+	memset(results, 0x00, sizeof(results));
+
+	for (int i = 0; i < nr_configs; i++) {
+		if (!__parse_config(configs[i])) goto out;
+
+		if (!quiet) fprintf(stderr, "Capacity-oblivious placement on %s\n", configs[i]);
+		__simulate(__place_oblivious, &results[i][0]);
+
+		if (!quiet) fprintf(stderr, "\nCapacity-aware placement on %s\n", configs[i]);
+		__simulate(__place_aware, &results[i][1]);
+		if (!quiet) fprintf(stderr, "\n");
+	}
+
+	printf("%-16s %-10s %10s %12s %10s %11s %10s\n", "CPUs", "Placement",
+			"Makespan", "Turnaround", "Waiting", "Util.", "Migrations");
+	for (int i = 0; i < nr_configs; i++) {
+		__parse_config(configs[i]);
+		__print_result(configs[i], "oblivious", &results[i][0]);
+		__print_result(configs[i], "aware", &results[i][1]);
+	}
+	ret = EXIT_SUCCESS;
+
+out:
+	free(queue);
+	free(tasks);
+	return ret;
+}
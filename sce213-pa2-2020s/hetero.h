@@ -0,0 +1,37 @@
+/**********************************************************************
+ * Copyright (c) 2020
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __HETERO_H__
+#define __HETERO_H__
+
+/***********************************************************************
+ * run_hetero(@processes, @configs, @nr_configs)
+ *
+ * DESCRIPTION
+ *   Simulate the processes in @processes, which are linked through @list
+ *   in the order of the script, on each CPU configuration in @configs.
+ *   A configuration is the comma-separated speeds of the CPUs (e.g.,
+ *   "2,1,1,1" for one big core twice as fast as three little cores), and
+ *   a process on a CPU of speed s makes s ticks of its lifespan per tick.
+ *   The processes are placed on the CPUs by the capacity-oblivious and the
+ *   capacity-aware placement, and the results are compared.
+ *   @processes is not modified.
+ *
+ * RETURN VALUE
+ *   EXIT_SUCCESS on success, EXIT_FAILURE otherwise
+ */
+int run_hetero(struct list_head *processes, char *configs[], int nr_configs);
+
+#endif
@@ -0,0 +1,58 @@
+/**********************************************************************
+ * Copyright (c) 2020
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+/**
+ * Metrics of a simulation. The framework accounts for each process when
+ * it exits.
+ */
+struct metrics {
+	unsigned int nr_processes;	/* # of exited processes */
+	unsigned long turnaround;	/* Sum of ticks from fork to exit */
+	unsigned long waiting;		/* Sum of ticks not making progress */
+	unsigned int p99_waiting;	/* 99th percentile of the waiting ticks */
+	unsigned long response;		/* Sum of ticks from fork to the first dispatch */
+	unsigned int makespan;		/* Ticks to finish all processes */
+	unsigned long blocking;		/* Sum of ticks blocked by lower-priority
+								   processes */
+	unsigned int nr_deadlocked;	/* # of processes left waiting for resources
+								   when no process can make a progress. They
+								   never exit, so are not in the sums above */
+
+	unsigned int nr_predictions;	/* # of predicted lifespans */
+	unsigned long prediction_error;	/* Sum of absolute prediction errors */
+};
+
+/**
+ * Account for the prediction error of a process that has run for @actual
+ * ticks whereas the scheduler estimated it to run for @estimate ticks
+ */
+void account_prediction(unsigned int estimate, unsigned int actual);
+
+/**
+ * Run the simulation of the process script @file under the scheduler of
+ * option @opt quietly, and put the result into @metrics.
+ * Return true on success.
+ */
+bool simulate(FILE *file, int opt, struct metrics *metrics);
+
+/**
+ * Return the scheduler selected by option @opt, or NULL if it is unknown
+ */
+struct scheduler *find_scheduler(int opt);
+
+#endif
@@ -0,0 +1,594 @@
+/**********************************************************************
+ * Copyright (c) 2020
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <math.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "parser.h"
+#include "process.h"
+#include "sched.h"
+#include "metrics.h"
+#include "montecarlo.h"
+
+/***********************************************************************
+ * Workload specification
+ *
+ * Random workloads are generated from a specification file like;
+ *
+ *   seed 2020           # Seed of the random workloads
+ *   workloads 10 200    # Run at least 10 and at most 200 workloads
+ *   precision 5         # Stop when all the 95% CIs are within +-5% of the means
+ *   processes 4 12      # Each workload has 4 to 12 processes
+ *   start 0 20          # which are forked at tick 0 to 20
+ *   lifespan 1 10       # and run for 1 to 10 ticks
+ *   prio 0 30           # with the priority of 0 to 30
+ *   class 0 3           # and the class of 0 to 3
+ *   class-lifespan 0 1 2   # Processes of class 0 run for 1 to 2 ticks instead
+ *   acquire 30 1 4      # 30% of the processes acquire one of resource 1 to 4
+ *
+ * Each range is inclusive and picked uniformly. The class-lifespan line
+ * may be given for each class below NR_CLASSES, and the classes without
+ * it take the lifespan line. The acquire line may be given up to
+ * MAX_ACQUIRES times. Ranges of the lines should not overlap since a
+ * process never gets a resource it already holds.
+ */
+#define MAX_ACQUIRES	8
+
+struct range {
+	int min;
+	int max;
+};
+
+struct spec {
+	unsigned long seed;
+	struct range workloads;
+	double precision;
+
+	struct range processes;
+	struct range start;
+	struct range lifespan;
+	struct range prio;
+	struct range class;
+	struct range class_lifespans[NR_CLASSES];	/* { 0, 0 } if not given */
+
+	int nr_acquires;
+	struct {
+		int percent;
+		struct range resource;
+	} acquires[MAX_ACQUIRES];
+};
+
+static inline bool strmatch(char * const str, const char *expect)
+{
+	return (strlen(str) == strlen(expect)) && (strncmp(str, expect, strlen(expect)) == 0);
+}
+
+static bool __parse_range(int nr_tokens, char *tokens[], struct range *range)
+{
+	if (nr_tokens != 3) return false;
+
+	range->min = atoi(tokens[1]);
+	range->max = atoi(tokens[2]);
+
+	return range->min <= range->max;
+}
+
+static bool __load_spec(char * const filename, struct spec *spec)
+{
+	char line[256];
+	bool ret = true;
+
+	FILE *file = fopen(filename, "r");
+	if (!file) {
+		fprintf(stderr, "Cannot open workload specification %s\n", filename);
+		return false;
+	}
+
+	*spec = (struct spec) {
+		.seed = 2020,
+		.workloads = { 10, 100 },
+		.precision = 5,
+		.processes = { 4, 8 },
+		.start = { 0, 10 },
+		.lifespan = { 1, 10 },
+		.prio = { 0, 0 },
+		.class = { 0, 0 },
+	};
+
+	while (ret && fgets(line, sizeof(line), file)) {
+		char *tokens[32] = { NULL };
+		int nr_tokens;
+
+		parse_command(line, &nr_tokens, tokens);
+
+		if (nr_tokens == 0) continue;
+
+		if (strmatch(tokens[0], "seed") && nr_tokens == 2) {
+			spec->seed = strtoul(tokens[1], NULL, 0);
+		} else if (strmatch(tokens[0], "workloads")) {
+			ret = __parse_range(nr_tokens, tokens, &spec->workloads);
+		} else if (strmatch(tokens[0], "precision") && nr_tokens == 2) {
+			spec->precision = atof(tokens[1]);
+		} else if (strmatch(tokens[0], "processes")) {
+			ret = __parse_range(nr_tokens, tokens, &spec->processes);
+		} else if (strmatch(tokens[0], "start")) {
+			ret = __parse_range(nr_tokens, tokens, &spec->start);
+		} else if (strmatch(tokens[0], "lifespan")) {
+			ret = __parse_range(nr_tokens, tokens, &spec->lifespan);
+		} else if (strmatch(tokens[0], "prio")) {
+			ret = __parse_range(nr_tokens, tokens, &spec->prio);
+		} else if (strmatch(tokens[0], "class")) {
+			ret = __parse_range(nr_tokens, tokens, &spec->class);
+		} else if (strmatch(tokens[0], "class-lifespan") && nr_tokens == 4) {
+			int class = atoi(tokens[1]);
+
+			if (class < 0 || class >= NR_CLASSES) {
+				ret = false;
+			} else {
+				struct range *range = spec->class_lifespans + class;
+
+				ret = __parse_range(nr_tokens - 1, tokens + 1, range) &&
+						range->min >= 1;
+			}
+		} else if (strmatch(tokens[0], "acquire") && nr_tokens == 4 &&
+				spec->nr_acquires < MAX_ACQUIRES) {
+			spec->acquires[spec->nr_acquires].percent = atoi(tokens[1]);
+			ret = __parse_range(nr_tokens - 1, tokens + 1,
+					&spec->acquires[spec->nr_acquires].resource);
+			spec->nr_acquires++;
+		} else {
+			ret = false;
+		}
+
+		if (!ret) fprintf(stderr, "Invalid specification %s\n", tokens[0]);
+	}
+	fclose(file);
+
+	if (spec->class.min < 0 || spec->class.max >= NR_CLASSES) {
+		fprintf(stderr, "Classes should be 0 to %d\n", NR_CLASSES - 1);
+		return false;
+	}
+	if (spec->workloads.min < 2 || spec->lifespan.min < 1) {
+		fprintf(stderr, "Need two or more workloads of non-empty processes\n");
+		return false;
+	}
+	return ret;
+}
+
+
+/***********************************************************************
+ * Workload generator
+ *
+ * Use our own PRNG (xorshift64*) so that a seed always generates the same
+ * workloads regardless of the C library.
+ */
+static unsigned long __rng_state;
+
+static void __seed(unsigned long seed)
+{
+	__rng_state = seed * 0x9E3779B97F4A7C15UL + 1;
+}
+
+static unsigned long __random(void)
+{
+	__rng_state ^= __rng_state >> 12;
+	__rng_state ^= __rng_state << 25;
+	__rng_state ^= __rng_state >> 27;
+	return __rng_state * 0x2545F4914F6CDD1DUL;
+}
+
+static int __pick(int min, int max)
+{
+	return min + (int)(__random() % (unsigned long)(max - min + 1));
+}
+
+/**
+ * Write the process script of workload #@index into @file
+ */
+static void __generate_workload(struct spec *spec, int index, FILE *file)
+{
+	int nr_processes;
+
+	__seed(spec->seed + index);
+
+	nr_processes = __pick(spec->processes.min, spec->processes.max);
+
+	for (int pid = 1; pid <= nr_processes; pid++) {
+		int class = __pick(spec->class.min, spec->class.max);
+		struct range *range = &spec->lifespan;
+		int lifespan;
+
+		/* The class decides the lifespan if it has its own range */
+		if (class >= 0 && class < NR_CLASSES && spec->class_lifespans[class].max) {
+			range = spec->class_lifespans + class;
+		}
+		lifespan = __pick(range->min, range->max);
+
+		fprintf(file, "process %d\n", pid);
+		fprintf(file, "\tstart %d\n", __pick(spec->start.min, spec->start.max));
+		fprintf(file, "\tlifespan %d\n", lifespan);
+		fprintf(file, "\tprio %d\n", __pick(spec->prio.min, spec->prio.max));
+		fprintf(file, "\tclass %d\n", class);
+
+		for (int i = 0; i < spec->nr_acquires; i++) {
+			int at;
+			if (__pick(0, 99) >= spec->acquires[i].percent) continue;
+
+			at = __pick(0, lifespan - 1);
+			fprintf(file, "\tacquire %d %d %d\n",
+					__pick(spec->acquires[i].resource.min,
+						   spec->acquires[i].resource.max),
+					at, __pick(1, lifespan - at));
+		}
+		fprintf(file, "end\n\n");
+	}
+}
+
+void dump_workload(char * const specfile, int index)
+{
+	struct spec spec;
+
+	if (!__load_spec(specfile, &spec)) return;
+
+	__generate_workload(&spec, index, stdout);
+}
+
+
+/***********************************************************************
+ * Statistics
+ */
+enum {
+	METRIC_TURNAROUND = 0,
+	METRIC_WAITING,
+	METRIC_P99_WAITING,
+	METRIC_RESPONSE,
+	METRIC_BLOCKING,
+	METRIC_MAKESPAN,
+	METRIC_PREDICTION,	/* Only for the predicting schedulers */
+	NR_METRICS,
+};
+
+static const char *__metric_sz[NR_METRICS] = {
+	"Turnaround",
+	"Waiting",
+	"P99 waiting",
+	"Response",
+	"Blocking",
+	"Makespan",
+	"Pred. error",
+};
+
+static void __metrics_to_samples(struct metrics *m, double samples[])
+{
+	double nr = m->nr_processes ? m->nr_processes : 1;
+
+	samples[METRIC_TURNAROUND] = m->turnaround / nr;
+	samples[METRIC_WAITING] = m->waiting / nr;
+	samples[METRIC_P99_WAITING] = m->p99_waiting;
+	samples[METRIC_RESPONSE] = m->response / nr;
+	samples[METRIC_BLOCKING] = m->blocking / nr;
+	samples[METRIC_MAKESPAN] = m->makespan;
+	samples[METRIC_PREDICTION] = m->nr_predictions ?
+			(double)m->prediction_error / m->nr_predictions : 0;
+}
+
+/**
+ * Two-sided 95% critical value of Student's t distribution
+ */
+static double __t95(int df)
+{
+	static const double table[] = {
+		0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+		2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093,
+		2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045,
+		2.042,
+	};
+
+	if (df <= 30) return table[df];
+	if (df <= 40) return 2.021;
+	if (df <= 60) return 2.000;
+	if (df <= 120) return 1.980;
+	return 1.960;
+}
+
+/**
+ * Calculate the mean and the half width of 95% CI of @nr values
+ */
+static void __confidence(double values[], int nr, double *mean, double *half)
+{
+	double sum = 0, sq = 0;
+
+	for (int i = 0; i < nr; i++) {
+		sum += values[i];
+	}
+	*mean = sum / nr;
+
+	for (int i = 0; i < nr; i++) {
+		sq += (values[i] - *mean) * (values[i] - *mean);
+	}
+	*half = __t95(nr - 1) * sqrt(sq / (nr - 1)) / sqrt(nr);
+}
+
+
+/***********************************************************************
+ * Monte Carlo simulation
+ */
+struct result {
+	int workload;
+	int policy;
+	bool ok;
+	struct metrics metrics;
+};
+
+/**
+ * Run workload #@index under the scheduler @opt in a child process, which
+ * writes the result into @fd. The simulator keeps its state in globals, so
+ * each run should start from a fresh process.
+ */
+static pid_t __spawn(struct spec *spec, int index, int policy, int opt, int fd)
+{
+	pid_t pid = fork();
+
+	if (pid == 0) {
+		struct result result = {
+			.workload = index,
+			.policy = policy,
+		};
+		FILE *file = tmpfile();
+
+		if (!file) {
+			perror("tmpfile");
+			_exit(EXIT_FAILURE);
+		}
+		if (!freopen("/dev/null", "w", stderr)) _exit(EXIT_FAILURE);
+
+		__generate_workload(spec, index, file);
+		rewind(file);
+
+		result.ok = simulate(file, opt, &result.metrics);
+
+		/* Writes no more than PIPE_BUF bytes are atomic */
+		if (write(fd, &result, sizeof(result)) != sizeof(result)) {
+			_exit(EXIT_FAILURE);
+		}
+		_exit(EXIT_SUCCESS);
+	}
+	return pid;
+}
+
+static bool __is_precise(struct spec *spec, double *samples[][NR_METRICS],
+		int nr_policies, int nr)
+{
+	for (int p = 0; p < nr_policies; p++) {
+		for (int m = 0; m < NR_METRICS; m++) {
+			double mean, half;
+
+			/**
+			 * The blocking time is around 0 under the priority policies,
+			 * so its CI is never within a percentage of the mean
+			 */
+			if (m == METRIC_BLOCKING) continue;
+
+			__confidence(samples[p][m], nr, &mean, &half);
+
+			if (half > fabs(mean) * spec->precision / 100 && half > 1e-9) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static void __report(const char *policies, double *samples[][NR_METRICS],
+		bool predicting[], int nr_policies, int nr)
+{
+	double *diff = malloc(sizeof(*diff) * nr);
+
+	printf("%-48s", "Mean +- 95% CI");
+	for (int m = 0; m < NR_METRICS; m++) {
+		printf("  %16s", __metric_sz[m]);
+	}
+	printf("\n");
+
+	for (int p = 0; p < nr_policies; p++) {
+		printf("%-48s", find_scheduler(policies[p])->name);
+		for (int m = 0; m < NR_METRICS; m++) {
+			double mean, half;
+
+			if (m == METRIC_PREDICTION && !predicting[p]) {
+				printf("  %16s", "-");
+				continue;
+			}
+			__confidence(samples[p][m], nr, &mean, &half);
+			printf("  %7.2f +- %5.2f", mean, half);
+		}
+		printf("\n");
+	}
+
+	if (nr_policies < 2) goto out;
+
+	/**
+	 * Every policy runs the same workloads, so compare them in pairs.
+	 * The difference is significant when its CI does not include 0.
+	 */
+	printf("\n%-48s", "Paired difference (* significant)");
+	for (int m = 0; m < METRIC_PREDICTION; m++) {
+		printf("  %16s", __metric_sz[m]);
+	}
+	printf("\n");
+
+	for (int a = 0; a < nr_policies; a++) {
+		for (int b = a + 1; b < nr_policies; b++) {
+			char name[64];
+
+			snprintf(name, sizeof(name), "%c - %c", policies[b], policies[a]);
+			printf("%-48s", name);
+
+			for (int m = 0; m < METRIC_PREDICTION; m++) {
+				double mean, half;
+
+				for (int i = 0; i < nr; i++) {
+					diff[i] = samples[b][m][i] - samples[a][m][i];
+				}
+				__confidence(diff, nr, &mean, &half);
+				printf("  %6.2f +- %5.2f%c", mean, half,
+						fabs(mean) > half ? '*' : ' ');
+			}
+			printf("\n");
+		}
+	}
+
+out:
+	free(diff);
+}
+
+int run_montecarlo(char * const specfile, const char *policies, int nr_workers)
+{
+	struct spec spec;
+	int nr_policies = strlen(policies);
+	double *samples[nr_policies][NR_METRICS];
+	bool predicting[nr_policies];
+	int nr_deadlocks[nr_policies];			/* Workloads deadlocked */
+	unsigned long nr_deadlocked[nr_policies];	/* Processes deadlocked */
+	int nr_done = 0;
+	bool converged = false;
+	bool deadlocked = false;
+	int fds[2];
+
+	if (!__load_spec(specfile, &spec)) return EXIT_FAILURE;
+
+	for (int p = 0; p < nr_policies; p++) {
+		predicting[p] = false;
+		nr_deadlocks[p] = 0;
+		nr_deadlocked[p] = 0;
+		if (!find_scheduler(policies[p])) {
+			fprintf(stderr, "Unknown scheduler option %c\n", policies[p]);
+			return EXIT_FAILURE;
+		}
+		for (int m = 0; m < NR_METRICS; m++) {
+			samples[p][m] = calloc(spec.workloads.max, sizeof(double));
+		}
+	}
+
+	if (pipe(fds)) {
+		perror("pipe");
+		return EXIT_FAILURE;
+	}
+
+	/**
+	 * Run the workloads in rounds of @nr_workers workloads. Check the
+	 * precision after each round and stop once all the metrics are precise
+	 * enough or the maximum number of workloads are simulated.
+	 */
+	while (nr_done < spec.workloads.max) {
+		int round = nr_workers;
+		int nr_jobs, nr_spawned = 0, nr_collected = 0;
+		int nr_running = 0;
+
+		if (nr_done + round > spec.workloads.max) {
+			round = spec.workloads.max - nr_done;
+		}
+		nr_jobs = round * nr_policies;
+
+		while (nr_collected < nr_jobs) {
+			struct result result;
+			double values[NR_METRICS];
+			int status;
+
+			if (nr_spawned < nr_jobs && nr_running < nr_workers) {
+				int index = nr_done + nr_spawned / nr_policies;
+				int policy = nr_spawned % nr_policies;
+
+				if (__spawn(&spec, index, policy, policies[policy], fds[1]) < 0) {
+					perror("fork");
+					return EXIT_FAILURE;
+				}
+				nr_spawned++;
+				nr_running++;
+				continue;
+			}
+
+			/**
+			 * Reap a worker first, so that a worker dying before writing
+			 * its result does not leave us blocked on the pipe forever.
+			 * A worker exits successfully only after writing its result,
+			 * so there is a result to read for each successful exit.
+			 */
+			if (wait(&status) < 0 || !WIFEXITED(status) ||
+					WEXITSTATUS(status) != EXIT_SUCCESS) {
+				fprintf(stderr, "Simulation failed; a worker exited without the result\n");
+				return EXIT_FAILURE;
+			}
+			if (read(fds[0], &result, sizeof(result)) != sizeof(result) || !result.ok) {
+				fprintf(stderr, "Simulation failed\n");
+				return EXIT_FAILURE;
+			}
+			nr_running--;
+			nr_collected++;
+
+			if (result.metrics.nr_predictions) {
+				predicting[result.policy] = true;
+			}
+			if (result.metrics.nr_deadlocked) {
+				nr_deadlocks[result.policy]++;
+				nr_deadlocked[result.policy] += result.metrics.nr_deadlocked;
+			}
+			__metrics_to_samples(&result.metrics, values);
+			for (int m = 0; m < NR_METRICS; m++) {
+				samples[result.policy][m][result.workload] = values[m];
+			}
+		}
+		nr_done += round;
+
+		if (nr_done >= spec.workloads.min &&
+				__is_precise(&spec, samples, nr_policies, nr_done)) {
+			converged = true;
+			break;
+		}
+	}
+	close(fds[0]);
+	close(fds[1]);
+
+	printf("Simulated %d workloads from seed %lu with %d workers", nr_done, spec.seed, nr_workers);
+	printf(" (%s)\n\n", converged ? "precise enough" : "reached the limit");
+
+	/**
+	 * The random resource acquisitions may deadlock. The processes left
+	 * waiting never exit, so they are not in the metrics of the workload.
+	 */
+	for (int p = 0; p < nr_policies; p++) {
+		if (!nr_deadlocks[p]) continue;
+		printf("%s deadlocked in %d workloads; %lu processes are not in the metrics\n",
+				find_scheduler(policies[p])->name, nr_deadlocks[p], nr_deadlocked[p]);
+		deadlocked = true;
+	}
+	if (deadlocked) printf("\n");
+	__report(policies, samples, predicting, nr_policies, nr_done);
+
+	for (int p = 0; p < nr_policies; p++) {
+		for (int m = 0; m < NR_METRICS; m++) {
+			free(samples[p][m]);
+		}
+	}
+	return EXIT_SUCCESS;
+}
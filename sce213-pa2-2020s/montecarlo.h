@@ -0,0 +1,44 @@
+/**********************************************************************
+ * Copyright (c) 2020
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __MONTECARLO_H__
+#define __MONTECARLO_H__
+
+/***********************************************************************
+ * run_montecarlo(@specfile, @policies, @nr_workers)
+ *
+ * DESCRIPTION
+ *   Generate random workloads from the specification in @specfile, and
+ *   simulate each of them under all the schedulers in @policies (given as
+ *   the scheduler options, e.g., "fsr") using @nr_workers worker processes.
+ *   Keep generating the workloads until the 95% confidence intervals of
+ *   all the metrics are within the precision in the specification, and
+ *   report the intervals and the paired differences between the policies.
+ *
+ * RETURN VALUE
+ *   EXIT_SUCCESS on success, EXIT_FAILURE otherwise
+ */
+int run_montecarlo(char * const specfile, const char *policies, int nr_workers);
+
+/***********************************************************************
+ * dump_workload(@specfile, @index)
+ *
+ * DESCRIPTION
+ *   Print the process script of workload #@index generated from @specfile
+ *   to reproduce the workload with the usual simulation.
+ */
+void dump_workload(char * const specfile, int index);
+
+#endif
@@ -17,6 +17,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #include "types.h"
@@ -53,6 +54,13 @@ extern unsigned int ticks;
 extern bool quiet;
 
 
+/**
+ * Find the process @pid which is running, ready, or waiting for a resource.
+ * NULL if there is no such process
+ */
+extern struct process *find_process(unsigned int pid);
+
+
 /***********************************************************************
  * Default FCFS resource acquision function
  *
@@ -127,6 +135,7 @@ void fcfs_release(int resource_id)
 
 		/* Update the process status */
 		waiter->status = PROCESS_READY;
+		waiter->ready_at = ticks;
 
 		/**
 		 * Put the waiter process into ready queue. The framework will
@@ -344,8 +353,25 @@ struct scheduler rr_scheduler = {
 
 /***********************************************************************
  * Priority scheduler
+ *
+ * With aging, the effective priority of a ready process rises by one for
+ * every @aging_interval ticks it has spent in the ready queue. It is
+ * computed from @ready_at when the processes are compared, so nothing
+ * walks the ready queue every tick.
  ***********************************************************************/
-static struct process *prio_schedule(void)
+extern unsigned int aging_interval;
+
+static unsigned int __aged_prio(struct process *p, unsigned int aging)
+{
+	unsigned int prio;
+
+	if (!aging) return p->prio;
+
+	prio = p->prio + (ticks - p->ready_at) / aging;
+	return prio < MAX_PRIO ? prio : MAX_PRIO;
+}
+
+static struct process *__prio_schedule(unsigned int aging)
 {
     struct process *next = NULL;
     struct process *temp = NULL;
@@ -365,41 +391,59 @@ pick_next:
    if(!list_empty(&readyqueue)){
 			list_for_each(entry, &readyqueue){
 				temp = list_entry(entry, struct process, list);
-				if(temp->prio > max){
-					max = temp->prio;
+				if(__aged_prio(temp, aging) > max){
+					max = __aged_prio(temp, aging);
 					next = temp;
 				}
-				else if(count == 0 && temp->prio == max){
+				else if(count == 0 && __aged_prio(temp, aging) == max){
 					count++;
 					next = temp;
 				}
 			}
 	list_del_init(&next->list);
+	next->ready_at = ticks;
 	}
     return next;
 
 pick_next2:
+	/**
+	 * The current process gets back into the ready queue, so it starts
+	 * aging from now on. Only the time in the ready queue raises the
+	 * priority; the time spent running does not.
+	 */
 	current->status = PROCESS_READY;
+	current->ready_at = ticks;
 	list_add_tail(&current->list, &readyqueue);
 			
 	next = current;
-	max = current->prio;
+	max = __aged_prio(current, aging);
 		if(!list_empty(&readyqueue)){
 			list_for_each(entry, &readyqueue){
 				temp = list_entry(entry, struct process, list);
-				if(temp->prio > max){
-					max = temp->prio;
+				if(__aged_prio(temp, aging) > max){
+					max = __aged_prio(temp, aging);
 					next = temp;
 				}
-				else if(count == 0 && temp->prio == max){
+				else if(count == 0 && __aged_prio(temp, aging) == max){
 					count++;
 					next = temp;
 				}
 			}
 			list_del_init(&next->list);
 		}
+	next->ready_at = ticks;
 	return next;
 }
+
+static struct process *prio_schedule(void)
+{
+	return __prio_schedule(0);
+}
+
+static struct process *aging_schedule(void)
+{
+	return __prio_schedule(aging_interval);
+}
 struct scheduler prio_scheduler = {
 	.name = "Priority",
 	.acquire = fcfs_acquire,
@@ -413,6 +457,13 @@ struct scheduler prio_scheduler = {
 	/* Implement your own prio_schedule() and attach it here */
 };
 
+struct scheduler aging_scheduler = {
+	.name = "Priority + Aging",
+	.acquire = fcfs_acquire,
+	.release = fcfs_release,
+	.schedule = aging_schedule,
+};
+
 
 /***********************************************************************
  * Priority scheduler with priority ceiling protocol
@@ -536,4 +587,482 @@ struct scheduler pip_scheduler = {
 };
 
 
+/***********************************************************************
+ * Priority scheduler with immediate and original priority ceiling protocols
+ *
+ * Unlike pcp_acquire() above that boosts the owner to MAX_PRIO, these use
+ * the real ceiling of each resource, which the framework computes from the
+ * script. Immediate ceiling raises the owner to the ceiling when it gets the
+ * resource. Original ceiling lets a process acquire a resource only if its
+ * priority is higher than the system ceiling, which is the highest ceiling
+ * among the resources held by the others, and lets the blocker inherit the
+ * priority of the blocked one.
+ ***********************************************************************/
+static unsigned int __held_ceiling(struct process *p)
+{
+	unsigned int ceiling = 0;
+
+	for (int i = 0; i < NR_RESOURCES; i++) {
+		if (resources[i].owner == p && resources[i].ceiling > ceiling) {
+			ceiling = resources[i].ceiling;
+		}
+	}
+	return ceiling;
+}
+
+static void __wake_up_highest(struct resource *r)
+{
+	struct process *waiter = NULL;
+	struct process *temp;
+
+	list_for_each_entry(temp, &r->waitqueue, list) {
+		if (!waiter || temp->prio > waiter->prio) waiter = temp;
+	}
+	if (!waiter) return;
+
+	assert(waiter->status == PROCESS_WAIT);
+
+	list_del_init(&waiter->list);
+	waiter->status = PROCESS_READY;
+	list_add_tail(&waiter->list, &readyqueue);
+}
+
+static bool icpp_acquire(int resource_id)
+{
+	struct resource *r = resources + resource_id;
+
+	if (!r->owner) {
+		r->owner = current;
+		if (current->prio < r->ceiling) current->prio = r->ceiling;
+		return true;
+	}
+
+	current->status = PROCESS_WAIT;
+
+	list_add_tail(&current->list, &r->waitqueue);
+
+	return false;
+}
+
+static void icpp_release(int resource_id)
+{
+	struct resource *r = resources + resource_id;
+	unsigned int ceiling;
+
+	assert(r->owner == current);
+
+	r->owner = NULL;
+
+	/* Fall back to the ceiling of the resources still being held */
+	ceiling = __held_ceiling(current);
+	current->prio = ceiling > current->prio_orig ? ceiling : current->prio_orig;
+
+	__wake_up_highest(r);
+}
+
+struct scheduler icpp_scheduler = {
+	.name = "Priority + Immediate Priority Ceiling Protocol",
+	.acquire = icpp_acquire,
+	.release = icpp_release,
+	.schedule = prio_schedule,
+};
+
+
+static bool ocpp_acquire(int resource_id)
+{
+	struct resource *r = resources + resource_id;
+	struct process *blocker = NULL;
+	unsigned int system_ceiling = 0;
+
+	for (int i = 0; i < NR_RESOURCES; i++) {
+		struct resource *rr = resources + i;
+		if (!rr->owner || rr->owner == current) continue;
+
+		if (!blocker || rr->ceiling > system_ceiling) {
+			system_ceiling = rr->ceiling;
+			blocker = rr->owner;
+		}
+	}
+
+	if (!r->owner && (!blocker || current->prio > system_ceiling)) {
+		r->owner = current;
+		return true;
+	}
+
+	/* The owner blocks us if any. Otherwise the system ceiling does */
+	if (r->owner) blocker = r->owner;
+
+	if (blocker->prio < current->prio) blocker->prio = current->prio;
+
+	current->status = PROCESS_WAIT;
+
+	list_add_tail(&current->list, &r->waitqueue);
+
+	return false;
+}
+
+static void __wake_up_all(struct resource *r)
+{
+	while (!list_empty(&r->waitqueue)) {
+		struct process *waiter =
+				list_first_entry(&r->waitqueue, struct process, list);
+
+		assert(waiter->status == PROCESS_WAIT);
+
+		list_del_init(&waiter->list);
+		waiter->status = PROCESS_READY;
+		list_add_tail(&waiter->list, &readyqueue);
+	}
+}
+
+static void ocpp_release(int resource_id)
+{
+	struct resource *r = resources + resource_id;
+	unsigned int ceiling;
+
+	assert(r->owner == current);
+
+	r->owner = NULL;
+
+	/* Keep the priority up to the ceilings of the resources still held */
+	ceiling = __held_ceiling(current);
+	current->prio = ceiling > current->prio_orig ? ceiling : current->prio_orig;
+
+	/**
+	 * Wake up the waiters of the released resource to retry. They boost
+	 * the blocker again if they are still blocked. The waiters of the other
+	 * free resources have been blocked by the system ceiling only, which
+	 * may have just dropped, so let them retry as well.
+	 */
+	__wake_up_all(r);
+	for (int i = 0; i < NR_RESOURCES; i++) {
+		if (!resources[i].owner) __wake_up_all(resources + i);
+	}
+}
+
+struct scheduler ocpp_scheduler = {
+	.name = "Priority + Original Priority Ceiling Protocol",
+	.acquire = ocpp_acquire,
+	.release = ocpp_release,
+	.schedule = prio_schedule,
+};
+
+
+/***********************************************************************
+ * SJF and SRTF schedulers with predicted bursts
+ *
+ * No real kernel knows how long a process will run. These schedulers
+ * estimate it from the processes of the same class that have exited
+ * before, and keep the ready processes in a min-heap keyed by the estimates.
+ * The heap is an index on @readyqueue; the ready processes stay in the
+ * ready queue until they are picked.
+ ***********************************************************************/
+#include "metrics.h"
+
+#define MAX_BURST			64	/* Longer bursts are counted as MAX_BURST */
+#define INITIAL_ESTIMATE	5	/* Estimate before seeing any process */
+
+extern double predict_alpha;
+extern bool predict_histogram;
+
+static struct predictor {
+	double tau;				/* Exponential average of the lifespans */
+	unsigned int nr_samples;
+	unsigned int histogram[MAX_BURST + 1];
+} predictors[NR_CLASSES];
+
+struct heap_node {
+	unsigned int key;
+	unsigned long seq;		/* To break ties in the arrival order */
+	struct process *process;
+};
+
+static struct heap_node *heap = NULL;
+static int heap_size = 0;
+static int heap_capacity = 0;
+static unsigned long heap_seq = 0;
+
+static bool preemptive = false;
+
+static inline bool __heap_less(struct heap_node *a, struct heap_node *b)
+{
+	return a->key < b->key || (a->key == b->key && a->seq < b->seq);
+}
+
+static void __heap_insert(struct heap_node node)
+{
+	int i;
+
+	if (heap_size == heap_capacity) {
+		heap_capacity = heap_capacity ? heap_capacity * 2 : 16;
+		heap = realloc(heap, sizeof(*heap) * heap_capacity);
+		assert(heap);
+	}
+
+	for (i = heap_size++; i > 0; i = (i - 1) / 2) {
+		if (!__heap_less(&node, heap + (i - 1) / 2)) break;
+		heap[i] = heap[(i - 1) / 2];
+	}
+	heap[i] = node;
+}
+
+static struct process *__heap_pop(void)
+{
+	struct process *p = heap[0].process;
+	struct heap_node last = heap[--heap_size];
+	int i = 0;
+
+	while (2 * i + 1 < heap_size) {
+		int child = 2 * i + 1;
+		if (child + 1 < heap_size && __heap_less(heap + child + 1, heap + child)) {
+			child++;
+		}
+		if (!__heap_less(heap + child, &last)) break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = last;
+
+	return p;
+}
+
+static inline struct predictor *__predictor(struct process *p)
+{
+	return predictors + p->class;
+}
+
+/**
+ * Estimate the remaining ticks of @p which has run for @p->age ticks
+ */
+static unsigned int __predict_remaining(struct process *p)
+{
+	struct predictor *pr = __predictor(p);
+	unsigned int tau;
+
+	if (predict_histogram && pr->nr_samples) {
+		/* Expected remaining ticks among the bursts longer than the age */
+		unsigned long sum = 0, nr = 0;
+
+		for (int len = p->age + 1; len <= MAX_BURST; len++) {
+			sum += (unsigned long)pr->histogram[len] * (len - p->age);
+			nr += pr->histogram[len];
+		}
+		return nr ? (sum + nr / 2) / nr : 1;
+	}
+
+	tau = (unsigned int)(pr->tau + 0.5);
+	return tau > p->age ? tau - p->age : 1;
+}
+
+static void __learn(struct process *p)
+{
+	struct predictor *pr = __predictor(p);
+
+	pr->tau = predict_alpha * p->lifespan + (1 - predict_alpha) * pr->tau;
+	pr->histogram[p->lifespan < MAX_BURST ? p->lifespan : MAX_BURST]++;
+	pr->nr_samples++;
+}
+
+static inline unsigned int __burst_key(struct process *p)
+{
+	/* SJF looks at the whole burst while SRTF looks at the remaining */
+	return preemptive ? __predict_remaining(p) : p->estimate;
+}
+
+static void __enqueue(struct process *p)
+{
+	__heap_insert((struct heap_node) {
+		.key = __burst_key(p),
+		.seq = heap_seq++,
+		.process = p,
+	});
+}
 
+static int __pred_initialize(void)
+{
+	for (int i = 0; i < NR_CLASSES; i++) {
+		memset(predictors + i, 0x00, sizeof(predictors[i]));
+		predictors[i].tau = INITIAL_ESTIMATE;
+	}
+	heap_size = 0;
+	heap_seq = 0;
+	return 0;
+}
+
+static int psjf_initialize(void)
+{
+	preemptive = false;
+	return __pred_initialize();
+}
+
+static int psrtf_initialize(void)
+{
+	preemptive = true;
+	return __pred_initialize();
+}
+
+static void pred_finalize(void)
+{
+	free(heap);
+	heap = NULL;
+	heap_size = heap_capacity = 0;
+}
+
+static void pred_forked(struct process *p)
+{
+	p->estimate = p->age + __predict_remaining(p);
+
+	/* May be introduced in the middle of the simulation */
+	if (p->status == PROCESS_READY && !list_empty(&p->list)) {
+		__enqueue(p);
+	}
+}
+
+static void pred_exiting(struct process *p)
+{
+	account_prediction(p->estimate, p->lifespan);
+	__learn(p);
+}
+
+static void pred_release(int resource_id)
+{
+	struct process *last = NULL;
+
+	if (!list_empty(&readyqueue)) {
+		last = list_last_entry(&readyqueue, struct process, list);
+	}
+
+	fcfs_release(resource_id);
+
+	/* Index the waiter woken up into the ready queue */
+	if (!list_empty(&readyqueue) &&
+			list_last_entry(&readyqueue, struct process, list) != last) {
+		__enqueue(list_last_entry(&readyqueue, struct process, list));
+	}
+}
+
+static struct process *pred_schedule(void)
+{
+	struct process *next;
+
+	if (!current || current->status == PROCESS_WAIT) {
+		goto pick_next;
+	}
+
+	if (current->age < current->lifespan) {
+		if (!preemptive || !heap_size || __burst_key(current) <= heap[0].key) {
+			return current;
+		}
+
+		/* Preempted by a process expected to finish earlier */
+		current->status = PROCESS_READY;
+		list_add_tail(&current->list, &readyqueue);
+		__enqueue(current);
+	}
+
+pick_next:
+	if (!heap_size) return NULL;
+
+	next = __heap_pop();
+	assert(next->status == PROCESS_READY);
+	list_del_init(&next->list);
+
+	return next;
+}
+
+static void __checkpoint_estimates(FILE *file, struct process *p)
+{
+	fprintf(file, "sched estimate %d %d\n", p->pid, p->estimate);
+}
+
+static void pred_checkpoint(FILE *file)
+{
+	struct process *p;
+
+	for (int i = 0; i < NR_CLASSES; i++) {
+		fprintf(file, "sched tau %d %.17g\n", i, predictors[i].tau);
+		for (int len = 0; len <= MAX_BURST; len++) {
+			if (!predictors[i].histogram[len]) continue;
+			fprintf(file, "sched hist %d %d %d\n", i, len, predictors[i].histogram[len]);
+		}
+	}
+
+	if (current && list_empty(&current->list)) {
+		__checkpoint_estimates(file, current);
+	}
+	list_for_each_entry(p, &readyqueue, list) {
+		__checkpoint_estimates(file, p);
+	}
+	for (int i = 0; i < NR_RESOURCES; i++) {
+		list_for_each_entry(p, &resources[i].waitqueue, list) {
+			__checkpoint_estimates(file, p);
+		}
+	}
+
+	for (int i = 0; i < heap_size; i++) {
+		fprintf(file, "sched heap %d %d %lu\n",
+				heap[i].process->pid, heap[i].key, heap[i].seq);
+	}
+	fprintf(file, "sched seq %lu\n", heap_seq);
+}
+
+static bool pred_restore(int nr_tokens, char *tokens[])
+{
+	struct process *p;
+
+	if (nr_tokens == 4 && strcmp(tokens[1], "tau") == 0) {
+		int class = atoi(tokens[2]);
+
+		if (class < 0 || class >= NR_CLASSES) return false;
+		predictors[class].tau = atof(tokens[3]);
+	} else if (nr_tokens == 5 && strcmp(tokens[1], "hist") == 0) {
+		int class = atoi(tokens[2]);
+		int len = atoi(tokens[3]);
+
+		if (class < 0 || class >= NR_CLASSES) return false;
+		if (len < 0 || len > MAX_BURST) return false;
+		predictors[class].histogram[len] = atoi(tokens[4]);
+		predictors[class].nr_samples += atoi(tokens[4]);
+	} else if (nr_tokens == 4 && strcmp(tokens[1], "estimate") == 0) {
+		if (!(p = find_process(atoi(tokens[2])))) return false;
+		p->estimate = atoi(tokens[3]);
+	} else if (nr_tokens == 5 && strcmp(tokens[1], "heap") == 0) {
+		if (!(p = find_process(atoi(tokens[2])))) return false;
+		__heap_insert((struct heap_node) {
+			.key = atoi(tokens[3]),
+			.seq = strtoul(tokens[4], NULL, 10),
+			.process = p,
+		});
+	} else if (nr_tokens == 3 && strcmp(tokens[1], "seq") == 0) {
+		heap_seq = strtoul(tokens[2], NULL, 10);
+	} else {
+		return false;
+	}
+	return true;
+}
+
+struct scheduler psjf_scheduler = {
+	.name = "Shortest-Job First (predicted)",
+	.acquire = fcfs_acquire,
+	.release = pred_release,
+	.initialize = psjf_initialize,
+	.finalize = pred_finalize,
+	.forked = pred_forked,
+	.exiting = pred_exiting,
+	.schedule = pred_schedule,
+	.checkpoint = pred_checkpoint,
+	.restore = pred_restore,
+};
+
+struct scheduler psrtf_scheduler = {
+	.name = "Shortest Remaining Time First (predicted)",
+	.acquire = fcfs_acquire,
+	.release = pred_release,
+	.initialize = psrtf_initialize,
+	.finalize = pred_finalize,
+	.forked = pred_forked,
+	.exiting = pred_exiting,
+	.schedule = pred_schedule,
+	.checkpoint = pred_checkpoint,
+	.restore = pred_restore,
+};
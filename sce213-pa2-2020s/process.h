@@ -46,10 +46,26 @@ struct process {
 	 */
 	unsigned int prio_orig;	/* The original priority of the process */
 
+	unsigned int class;		/* Class of the process, below NR_CLASSES.
+							   0 by default */
+
+	unsigned int threads;	/* # of threads of the process. 1 by default */
+
+	unsigned int estimate;	/* Estimated lifespan of the process for the
+							   schedulers predicting burst lengths */
+
+	unsigned int ready_at;	/* When the process gets into the ready queue */
+
 
 	/* DO NOT ACCESS FOLLOWING VARIABLES */
 	unsigned int __starts_at;	/* When to fork the process */
 
+	int __first_run_at;			/* When the process is dispatched first.
+								   -1 until then */
+
+	unsigned int __base_prio;	/* Priority given by the script */
+	unsigned int __blocking;	/* Ticks blocked by lower-priority processes */
+
 	struct list_head __resources_to_acquire;
 								/* Schedule to acquire resources */
 
@@ -63,5 +79,6 @@ struct process {
 void dump_status(void);
 
 #define MAX_PRIO	64	/* Maximum value for priority */
+#define NR_CLASSES	8	/* Classes of the processes are 0 to NR_CLASSES - 1 */
 
 #endif
@@ -33,6 +33,13 @@ struct resource {
 	 * list head to list processes that are wanting for the resource
 	 */
 	struct list_head waitqueue;
+
+	/**
+	 * The highest original priority of the processes that will ever
+	 * acquire this resource. The framework computes it from the process
+	 * script.
+	 */
+	unsigned int ceiling;
 };
 
 /**
@@ -22,6 +22,8 @@
 #include <assert.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 
 #include "types.h"
 #include "list_head.h"
@@ -31,6 +33,10 @@
 #include "resource.h"
 
 #include "sched.h"
+#include "metrics.h"
+#include "montecarlo.h"
+#include "gang.h"
+#include "hetero.h"
 
 /**
  * List head to hold the processes ready to run
@@ -66,6 +72,19 @@ static LIST_HEAD(__forkqueue);
 
 bool quiet = false;
 
+/**
+ * Burst predictor for the predicting schedulers. Exponential averaging with
+ * @predict_alpha by default, or per-class histograms if @predict_histogram
+ */
+double predict_alpha = 0.5;
+bool predict_histogram = false;
+
+/**
+ * Ticks in the ready queue to raise the priority by one for the priority
+ * scheduler with aging
+ */
+unsigned int aging_interval = 5;
+
 static const char * __process_status_sz[] = {
 	"RDY",
 	"RUN",
@@ -81,10 +100,109 @@ extern struct scheduler sjf_scheduler;
 extern struct scheduler srtf_scheduler;
 extern struct scheduler rr_scheduler;
 extern struct scheduler prio_scheduler;
+extern struct scheduler aging_scheduler;
 extern struct scheduler pcp_scheduler;
 extern struct scheduler pip_scheduler;
+extern struct scheduler icpp_scheduler;
+extern struct scheduler ocpp_scheduler;
+extern struct scheduler psjf_scheduler;
+extern struct scheduler psrtf_scheduler;
 
 static struct scheduler *sched = &fifo_scheduler;
+static int sched_opt = 'f';
+
+/**
+ * Number of CPUs to simulate the parallel jobs on. 0 for the usual
+ * uniprocessor simulation
+ */
+static int nr_cpus = 0;
+
+/**
+ * CPU configurations to simulate the processes on heterogeneous CPUs
+ */
+#define MAX_CPU_CONFIGS	8
+static char *cpu_configs[MAX_CPU_CONFIGS];
+static int nr_cpu_configs = 0;
+
+/**
+ * Metrics accounted for the exited processes
+ */
+static struct metrics metrics = { 0 };
+
+struct exit_record {
+	unsigned int pid;
+	unsigned int prio;
+	unsigned int turnaround;
+	unsigned int waiting;
+	unsigned int response;
+	unsigned int blocking;
+};
+static struct exit_record *exit_records = NULL;
+static int nr_exit_records = 0;
+
+/**
+ * Streaming mode. The processes are read from @stream while simulating
+ * instead of loading the whole script beforehand, and the metrics of every
+ * @window ticks are printed. No exit record is kept so that the state stays
+ * bounded under an unbounded stream, and the events are not printed in the
+ * quiet mode.
+ */
+static FILE *stream = NULL;
+static unsigned int window = 0;
+
+static struct window_stats {
+	unsigned int nr_exited;
+	unsigned int *waiting;		/* Waiting ticks of the exited processes.
+								   At most one exits per tick */
+	unsigned long queue_length;	/* Sum of the ready queue lengths */
+	unsigned int max_queue_length;
+	unsigned int starts_at;
+} window_stats = { 0 };
+
+void account_prediction(unsigned int estimate, unsigned int actual)
+{
+	metrics.nr_predictions++;
+	metrics.prediction_error += estimate > actual ? estimate - actual : actual - estimate;
+}
+
+/**
+ * Checkpoint and what-if branching
+ */
+static int checkpoint_at = -1;			/* Tick to take the checkpoint at */
+static char *checkpoint_file = NULL;	/* Snapshot file to write */
+static char *branch_policies = NULL;	/* Schedulers to branch into */
+static char branch_tag[8] = "";			/* Prefix of the events in a branch */
+
+struct scheduler *find_scheduler(int opt)
+{
+	switch (opt) {
+	case 'f':
+		return &fifo_scheduler;
+	case 's':
+		return &sjf_scheduler;
+	case 'S':
+		return &srtf_scheduler;
+	case 'r':
+		return &rr_scheduler;
+	case 'p':
+		return &prio_scheduler;
+	case 'g':
+		return &aging_scheduler;
+	case 'i':
+		return &pip_scheduler;
+	case 'c':
+		return &pcp_scheduler;
+	case 'k':
+		return &icpp_scheduler;
+	case 'o':
+		return &ocpp_scheduler;
+	case 'x':
+		return &psjf_scheduler;
+	case 'X':
+		return &psrtf_scheduler;
+	}
+	return NULL;
+}
 
 void dump_status(void)
 {
@@ -127,7 +245,8 @@ void dump_status(void)
 }
 
 #define __print_event(pid, string, args...) do { \
-	fprintf(stderr, "%3d: ", ticks); \
+	if (window && quiet) break; \
+	fprintf(stderr, "%s%3d: ", branch_tag, ticks); \
 	for (int i = 0; i < pid; i++) { \
 		fprintf(stderr, "    "); \
 	} \
@@ -148,18 +267,25 @@ static void __briefing_process(struct process *p)
 	printf("- Process %d: Forked at tick %d and run for %d tick%s with initial priority %d\n",
 				p->pid, p->__starts_at, p->lifespan,
 				p->lifespan >= 2 ? "s" : "", p->prio);
+	if (p->threads > 1) {
+		printf("    Run %d threads in parallel\n", p->threads);
+	}
 
 	list_for_each_entry(rs, &p->__resources_to_acquire, list) {
 		printf("    Acquire resource %d at %d for %d\n", rs->resource_id, rs->at, rs->duration);
 	}
 }
 
-static int __load_script(char * const filename)
+/**
+ * Parse @nr_processes processes from @file, or all the processes if it is
+ * negative. Return the number of parsed processes, or -1 on error.
+ */
+static int __parse_script(FILE *file, int nr_processes)
 {
 	char line[256];
 	struct process *p = NULL;
+	int nr_parsed = 0;
 
-	FILE *file = fopen(filename, "r");
 	while (fgets(line, sizeof(line), file)) {
 		char *tokens[32] = { NULL };
 		int nr_tokens;
@@ -175,6 +301,8 @@ static int __load_script(char * const filename)
 			memset(p, 0x00, sizeof(*p));
 
 			p->pid = atoi(tokens[1]);
+			p->threads = 1;
+			p->__first_run_at = -1;
 
 			INIT_LIST_HEAD(&p->list);
 			INIT_LIST_HEAD(&p->__resources_to_acquire);
@@ -188,9 +316,16 @@ static int __load_script(char * const filename)
 
 			list_add_tail(&p->list, &__forkqueue);
 
+			/* Raise the ceilings of the resources to acquire */
+			list_for_each_entry(rs, &p->__resources_to_acquire, list) {
+				struct resource *r = resources + rs->resource_id;
+				if (r->ceiling < p->prio) r->ceiling = p->prio;
+			}
+
 			__briefing_process(p);
 			p = NULL;
 
+			if (++nr_parsed == nr_processes) return nr_parsed;
 			continue;
 		}
 
@@ -199,10 +334,26 @@ static int __load_script(char * const filename)
 			p->lifespan = atoi(tokens[1]);
 		} else if (strmatch(tokens[0], "prio")) {
 			assert(nr_tokens == 2);
-			p->prio = p->prio_orig = atoi(tokens[1]);
+			p->prio = p->prio_orig = p->__base_prio = atoi(tokens[1]);
 		} else if (strmatch(tokens[0], "start")) {
 			assert(nr_tokens == 2);
 			p->__starts_at = atoi(tokens[1]);
+		} else if (strmatch(tokens[0], "class")) {
+			assert(nr_tokens == 2);
+			p->class = atoi(tokens[1]);
+			if (atoi(tokens[1]) < 0 || p->class >= NR_CLASSES) {
+				fprintf(stderr, "Process %d should be of class 0 to %d\n",
+						p->pid, NR_CLASSES - 1);
+				return -1;
+			}
+		} else if (strmatch(tokens[0], "threads")) {
+			assert(nr_tokens == 2);
+			p->threads = atoi(tokens[1]);
+			if (p->threads < 1 || p->threads > MAX_CPUS) {
+				fprintf(stderr, "Process %d should have 1 to %d threads\n",
+						p->pid, MAX_CPUS);
+				return -1;
+			}
 		} else if (strmatch(tokens[0], "acquire")) {
 			struct resource_schedule *rs;
 			assert(nr_tokens == 4);
@@ -216,12 +367,22 @@ static int __load_script(char * const filename)
 			list_add_tail(&rs->list, &p->__resources_to_acquire);
 		} else {
 			fprintf(stderr, "Unknown property %s\n", tokens[0]);
-			return false;
+			return -1;
 		}
 	}
+	if (!quiet && nr_processes < 0) printf("\n");
+	return nr_parsed;
+}
+
+static int __load_script(char * const filename)
+{
+	int ret;
+
+	FILE *file = fopen(filename, "r");
+	ret = __parse_script(file, -1) >= 0;
 	fclose(file);
-	if (!quiet) printf("\n");
-	return true;
+
+	return ret;
 }
 
 
@@ -236,6 +397,7 @@ static int __fork_on_schedule()
 		if (p->__starts_at <= ticks) {
 			list_move_tail(&p->list, &readyqueue);
 			p->status = PROCESS_READY;
+			p->ready_at = ticks;
 			__print_event(p->pid, "N");
 			if (sched->forked) sched->forked(p);
 			nr_forked++;
@@ -244,6 +406,171 @@ static int __fork_on_schedule()
 	return nr_forked;
 }
 
+static void __account_exit(unsigned int pid, unsigned int prio,
+		unsigned int turnaround, unsigned int waiting, unsigned int response,
+		unsigned int blocking)
+{
+	struct exit_record *er;
+
+	metrics.nr_processes++;
+	metrics.turnaround += turnaround;
+	metrics.waiting += waiting;
+	metrics.response += response;
+	metrics.blocking += blocking;
+
+	if (window) {
+		if (window_stats.nr_exited < window) {
+			window_stats.waiting[window_stats.nr_exited++] = waiting;
+		}
+		return;
+	}
+
+	exit_records = realloc(exit_records, sizeof(*er) * (nr_exit_records + 1));
+	er = exit_records + nr_exit_records++;
+	*er = (struct exit_record) {
+		.pid = pid,
+		.prio = prio,
+		.turnaround = turnaround,
+		.waiting = waiting,
+		.response = response,
+		.blocking = blocking,
+	};
+}
+
+static int __compare_uint(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a;
+	unsigned int y = *(const unsigned int *)b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * Return the @percent-th percentile of @nr @values by the nearest-rank
+ * method. @values gets sorted.
+ */
+static unsigned int __percentile(unsigned int *values, int nr, int percent)
+{
+	int rank;
+
+	if (!nr) return 0;
+
+	qsort(values, nr, sizeof(*values), __compare_uint);
+
+	rank = (nr * percent + 99) / 100;
+	return values[rank ? rank - 1 : 0];
+}
+
+/**
+ * Return the @percent-th percentile of the waiting ticks of the exited
+ * processes
+ */
+static unsigned int __percentile_waiting(int percent)
+{
+	unsigned int *waiting;
+	unsigned int value;
+
+	if (!nr_exit_records) return 0;
+
+	waiting = malloc(sizeof(*waiting) * nr_exit_records);
+	for (int i = 0; i < nr_exit_records; i++) {
+		waiting[i] = exit_records[i].waiting;
+	}
+	value = __percentile(waiting, nr_exit_records, percent);
+
+	free(waiting);
+	return value;
+}
+
+/**
+ * Read the processes from the stream until one starts in the future so
+ * that all the processes forked at this tick are in @__forkqueue
+ */
+static void __feed_stream(void)
+{
+	while (stream) {
+		int nr_parsed;
+
+		if (!list_empty(&__forkqueue)) {
+			struct process *last =
+					list_last_entry(&__forkqueue, struct process, list);
+			if (last->__starts_at > ticks) return;
+		}
+
+		nr_parsed = __parse_script(stream, 1);
+		if (nr_parsed <= 0) {
+			if (nr_parsed < 0) fprintf(stderr, "Stop reading the stream\n");
+			if (stream != stdin) fclose(stream);
+			stream = NULL;
+		}
+	}
+}
+
+/**
+ * Print the metrics of the window ending at tick @ends_at and start a new one
+ */
+static void __print_window(unsigned int ends_at)
+{
+	struct window_stats *ws = &window_stats;
+	unsigned int nr_ticks = ends_at + 1 - ws->starts_at;
+
+	printf("%s%5d-%5d: %3d exited, throughput %.2f, p99 waiting %3d, "
+			"queue length %.2f (max %d)\n",
+			branch_tag, ws->starts_at, ends_at, ws->nr_exited,
+			(double)ws->nr_exited / nr_ticks,
+			__percentile(ws->waiting, ws->nr_exited, 99),
+			(double)ws->queue_length / nr_ticks, ws->max_queue_length);
+	fflush(stdout);
+
+	ws->nr_exited = 0;
+	ws->queue_length = 0;
+	ws->max_queue_length = 0;
+	ws->starts_at = ends_at + 1;
+}
+
+/**
+ * Account for the ready queue length in this tick, and print the metrics
+ * of the window if it ends at this tick
+ */
+static void __account_window(void)
+{
+	struct process *p;
+	unsigned int queue_length = 0;
+
+	if (!window) return;
+
+	list_for_each_entry(p, &readyqueue, list) {
+		queue_length++;
+	}
+	window_stats.queue_length += queue_length;
+	if (queue_length > window_stats.max_queue_length) {
+		window_stats.max_queue_length = queue_length;
+	}
+
+	if ((ticks + 1) % window == 0) __print_window(ticks);
+}
+
+/**
+ * Account for the ticks that the processes are blocked by a lower-priority
+ * process; they are ready or waiting for resources while a process with
+ * lower script priority makes a progress in this tick.
+ */
+static void __account_blocking(void)
+{
+	struct process *p;
+
+	if (!current || current->status != PROCESS_RUNNING) return;
+
+	list_for_each_entry(p, &readyqueue, list) {
+		if (p->__base_prio > current->__base_prio) p->__blocking++;
+	}
+	for (int i = 0; i < NR_RESOURCES; i++) {
+		list_for_each_entry(p, &resources[i].waitqueue, list) {
+			if (p->__base_prio > current->__base_prio) p->__blocking++;
+		}
+	}
+}
+
 /**
  * Exit the process
  */
@@ -262,6 +589,10 @@ static void __exit_process(struct process *p)
 
 	__print_event(p->pid, "X");
 
+	__account_exit(p->pid, p->__base_prio, ticks - p->__starts_at,
+			ticks - p->__starts_at - p->lifespan,
+			p->__first_run_at - p->__starts_at, p->__blocking);
+
 	free(p);
 }
 
@@ -314,6 +645,373 @@ static void __run_current_release()
 }
 
 
+/***********************************************************************
+ * Checkpoint and restore
+ *
+ * A snapshot is a text file describing the simulation at the beginning of
+ * a tick. Processes are listed in the order of the list they are linked to
+ * so that restoring them with list_add_tail() rebuilds the same queues.
+ *
+ *   snapshot <ticks> <scheduler option>
+ *   process <pid> <status> <age> <lifespan> <prio> <prio_orig> <class>
+ *           <ready_at> <starts_at> <first_run_at> <base_prio> <blocking>
+ *           [ready|fork|wait <resource id>|none] {current}
+ *     acquire <resource id> <at> <duration>
+ *     hold <resource id> <at> <duration>
+ *   end
+ *   owner <resource id> <pid>
+ *   ceiling <resource id> <ceiling>
+ *   exited <pid> <prio> <turnaround> <waiting> <response> <blocking>
+ *   metrics <nr_predictions> <prediction_error>
+ *   policy
+ *   sched ...
+ */
+static void __checkpoint_process(FILE *file, struct process *p, const char *where, int resource_id)
+{
+	struct resource_schedule *rs;
+
+	fprintf(file, "process %d %s %d %d %d %d %d %d %d %d %d %d %s",
+			p->pid, __process_status_sz[p->status], p->age, p->lifespan,
+			p->prio, p->prio_orig, p->class, p->ready_at,
+			p->__starts_at, p->__first_run_at,
+			p->__base_prio, p->__blocking, where);
+	if (resource_id >= 0) fprintf(file, " %d", resource_id);
+	if (p == current) fprintf(file, " current");
+	fprintf(file, "\n");
+
+	if (p->threads > 1) {
+		fprintf(file, "  threads %d\n", p->threads);
+	}
+	list_for_each_entry(rs, &p->__resources_to_acquire, list) {
+		fprintf(file, "  acquire %d %d %d\n", rs->resource_id, rs->at, rs->duration);
+	}
+	list_for_each_entry(rs, &p->__resources_holding, list) {
+		fprintf(file, "  hold %d %d %d\n", rs->resource_id, rs->at, rs->duration);
+	}
+	fprintf(file, "end\n");
+}
+
+static bool __checkpoint(char * const filename)
+{
+	struct process *p;
+
+	FILE *file = fopen(filename, "w");
+	if (!file) {
+		fprintf(stderr, "Cannot open %s to write the snapshot\n", filename);
+		return false;
+	}
+
+	fprintf(file, "snapshot %d %c\n", ticks, sched_opt);
+
+	if (current && list_empty(&current->list)) {
+		__checkpoint_process(file, current, "none", -1);
+	}
+	list_for_each_entry(p, &readyqueue, list) {
+		__checkpoint_process(file, p, "ready", -1);
+	}
+	for (int i = 0; i < NR_RESOURCES; i++) {
+		list_for_each_entry(p, &resources[i].waitqueue, list) {
+			__checkpoint_process(file, p, "wait", i);
+		}
+	}
+	list_for_each_entry(p, &__forkqueue, list) {
+		__checkpoint_process(file, p, "fork", -1);
+	}
+
+	for (int i = 0; i < NR_RESOURCES; i++) {
+		if (resources[i].owner) {
+			fprintf(file, "owner %d %d\n", i, resources[i].owner->pid);
+		}
+		if (resources[i].ceiling) {
+			fprintf(file, "ceiling %d %d\n", i, resources[i].ceiling);
+		}
+	}
+	for (int i = 0; i < nr_exit_records; i++) {
+		struct exit_record *er = exit_records + i;
+		fprintf(file, "exited %d %d %d %d %d %d\n", er->pid, er->prio,
+				er->turnaround, er->waiting, er->response, er->blocking);
+	}
+	fprintf(file, "metrics %d %lu\n",
+			metrics.nr_predictions, metrics.prediction_error);
+
+	fprintf(file, "policy\n");
+	if (sched->checkpoint) sched->checkpoint(file);
+
+	fclose(file);
+	return true;
+}
+
+/**
+ * Find the process @pid which is running, ready, or waiting for a resource
+ */
+struct process *find_process(unsigned int pid)
+{
+	struct process *p;
+
+	if (current && current->pid == pid) return current;
+
+	list_for_each_entry(p, &readyqueue, list) {
+		if (p->pid == pid) return p;
+	}
+	for (int i = 0; i < NR_RESOURCES; i++) {
+		list_for_each_entry(p, &resources[i].waitqueue, list) {
+			if (p->pid == pid) return p;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Introduce the processes that are already forked to the scheduler which
+ * takes over the simulation in the middle.
+ */
+static void __adopt_processes(void)
+{
+	struct process *p;
+
+	if (!sched->forked) return;
+
+	if (current && list_empty(&current->list)) {
+		sched->forked(current);
+	}
+	list_for_each_entry(p, &readyqueue, list) {
+		sched->forked(p);
+	}
+	for (int i = 0; i < NR_RESOURCES; i++) {
+		list_for_each_entry(p, &resources[i].waitqueue, list) {
+			sched->forked(p);
+		}
+	}
+}
+
+static bool __load_snapshot(char * const filename, bool keep_sched)
+{
+	char line[256];
+	struct process *p = NULL;
+	bool same_sched = false;
+	bool in_policy = false;
+
+	FILE *file = fopen(filename, "r");
+	if (!file) {
+		fprintf(stderr, "Cannot open snapshot %s\n", filename);
+		return false;
+	}
+
+	while (fgets(line, sizeof(line), file)) {
+		char *tokens[32] = { NULL };
+		int nr_tokens;
+
+		parse_command(line, &nr_tokens, tokens);
+
+		if (nr_tokens == 0) continue;
+
+		if (in_policy) {
+			assert(strmatch(tokens[0], "sched"));
+			/* The state belongs to the other scheduler. Skip it */
+			if (!same_sched) continue;
+
+			if (!sched->restore || !sched->restore(nr_tokens, tokens)) {
+				fprintf(stderr, "Cannot restore the scheduler state\n");
+				goto out_fail;
+			}
+		} else if (strmatch(tokens[0], "snapshot")) {
+			assert(nr_tokens == 3);
+			ticks = atoi(tokens[1]);
+			if (!keep_sched) {
+				sched_opt = tokens[2][0];
+				sched = find_scheduler(sched_opt);
+				assert(sched);
+			}
+			same_sched = (sched_opt == tokens[2][0]);
+		} else if (strmatch(tokens[0], "process")) {
+			int status;
+			assert(nr_tokens >= 14);
+
+			p = malloc(sizeof(*p));
+			memset(p, 0x00, sizeof(*p));
+
+			INIT_LIST_HEAD(&p->list);
+			INIT_LIST_HEAD(&p->__resources_to_acquire);
+			INIT_LIST_HEAD(&p->__resources_holding);
+
+			p->pid = atoi(tokens[1]);
+			p->threads = 1;
+			for (status = PROCESS_READY; status < PROCESS_EXIT; status++) {
+				if (strmatch(tokens[2], __process_status_sz[status])) break;
+			}
+			p->status = status;
+			p->age = atoi(tokens[3]);
+			p->lifespan = atoi(tokens[4]);
+			p->prio = atoi(tokens[5]);
+			p->prio_orig = atoi(tokens[6]);
+			p->class = atoi(tokens[7]);
+			p->ready_at = atoi(tokens[8]);
+			p->__starts_at = atoi(tokens[9]);
+			p->__first_run_at = atoi(tokens[10]);
+			p->__base_prio = atoi(tokens[11]);
+			p->__blocking = atoi(tokens[12]);
+			if (atoi(tokens[7]) < 0 || p->class >= NR_CLASSES) {
+				fprintf(stderr, "Invalid class of process %d\n", p->pid);
+				free(p);
+				goto out_fail;
+			}
+
+			if (strmatch(tokens[13], "ready")) {
+				list_add_tail(&p->list, &readyqueue);
+			} else if (strmatch(tokens[13], "fork")) {
+				list_add_tail(&p->list, &__forkqueue);
+			} else if (strmatch(tokens[13], "wait")) {
+				assert(nr_tokens >= 15);
+				list_add_tail(&p->list, &resources[atoi(tokens[14])].waitqueue);
+			}
+
+			if (strmatch(tokens[nr_tokens - 1], "current")) {
+				current = p;
+			}
+		} else if (strmatch(tokens[0], "threads")) {
+			assert(p && nr_tokens == 2);
+			p->threads = atoi(tokens[1]);
+		} else if (strmatch(tokens[0], "acquire") || strmatch(tokens[0], "hold")) {
+			struct resource_schedule *rs;
+			assert(p && nr_tokens == 4);
+
+			rs = malloc(sizeof(*rs));
+
+			rs->resource_id = atoi(tokens[1]);
+			rs->at = atoi(tokens[2]);
+			rs->duration = atoi(tokens[3]);
+
+			if (strmatch(tokens[0], "hold")) {
+				list_add_tail(&rs->list, &p->__resources_holding);
+			} else {
+				list_add_tail(&rs->list, &p->__resources_to_acquire);
+			}
+		} else if (strmatch(tokens[0], "end")) {
+			assert(p);
+			p = NULL;
+		} else if (strmatch(tokens[0], "owner")) {
+			struct resource *r;
+			assert(nr_tokens == 3);
+
+			r = resources + atoi(tokens[1]);
+			r->owner = find_process(atoi(tokens[2]));
+			assert(r->owner);
+		} else if (strmatch(tokens[0], "metrics")) {
+			assert(nr_tokens == 3);
+			metrics.nr_predictions = atoi(tokens[1]);
+			metrics.prediction_error = atol(tokens[2]);
+		} else if (strmatch(tokens[0], "ceiling")) {
+			assert(nr_tokens == 3);
+			resources[atoi(tokens[1])].ceiling = atoi(tokens[2]);
+		} else if (strmatch(tokens[0], "exited")) {
+			assert(nr_tokens == 7);
+			__account_exit(atoi(tokens[1]), atoi(tokens[2]), atoi(tokens[3]),
+					atoi(tokens[4]), atoi(tokens[5]), atoi(tokens[6]));
+		} else if (strmatch(tokens[0], "policy")) {
+			/* Framework state is all set. Bring up the scheduler */
+			in_policy = true;
+
+			if (sched->initialize && sched->initialize()) goto out_fail;
+			if (!same_sched) __adopt_processes();
+		} else {
+			fprintf(stderr, "Unknown snapshot entry %s\n", tokens[0]);
+			goto out_fail;
+		}
+	}
+	fclose(file);
+
+	if (!quiet) {
+		printf("Restored the simulation at tick %d%s\n\n", ticks,
+				same_sched ? "" : " under a different scheduler");
+	}
+	return in_policy;
+
+out_fail:
+	fclose(file);
+	return false;
+}
+
+/**
+ * Branch the simulation into the schedulers in @branch_policies. Each branch
+ * is a child process that shares the warm state through copy-on-write and
+ * continues the simulation under its own scheduler. The parent waits for
+ * all the branches and exits.
+ */
+static bool __branch(void)
+{
+	int nr_branches = 0;
+
+	if (!quiet) printf("Branching at tick %d into %s\n\n", ticks, branch_policies);
+	fflush(stdout);
+	fflush(stderr);
+
+	for (char *c = branch_policies; *c; c++) {
+		struct scheduler *to = find_scheduler(*c);
+		pid_t pid;
+
+		if (!to) {
+			fprintf(stderr, "Unknown scheduler option %c to branch into\n", *c);
+			continue;
+		}
+
+		pid = fork();
+		if (pid == 0) {
+			/* Prevent the lines from the branches being mixed up */
+			setvbuf(stdout, NULL, _IOLBF, 0);
+			setvbuf(stderr, NULL, _IOLBF, 0);
+			snprintf(branch_tag, sizeof(branch_tag), "[%c] ", *c);
+
+			if (to != sched) {
+				if (sched->finalize) sched->finalize();
+				sched = to;
+				sched_opt = *c;
+				if (sched->initialize && sched->initialize()) exit(EXIT_FAILURE);
+				__adopt_processes();
+			}
+			return true;
+		} else if (pid > 0) {
+			nr_branches++;
+		} else {
+			perror("fork");
+		}
+	}
+
+	while (nr_branches--) {
+		wait(NULL);
+	}
+	exit(EXIT_SUCCESS);
+}
+
+static bool __do_checkpoint(void)
+{
+	if (checkpoint_file && !__checkpoint(checkpoint_file)) {
+		return false;
+	}
+	if (branch_policies) {
+		return __branch();
+	}
+	return true;
+}
+
+
+/**
+ * Count the processes left in the wait queues when no process is ready nor
+ * to be forked. They wait for each other, and never make a progress.
+ */
+static unsigned int __count_deadlocked(void)
+{
+	unsigned int nr = 0;
+
+	for (int i = 0; i < NR_RESOURCES; i++) {
+		struct process *p;
+		list_for_each_entry(p, &resources[i].waitqueue, list) {
+			nr++;
+		}
+	}
+	return nr;
+}
+
+
 /***********************************************************************
  * The main loop for the scheduler simulation
  */
@@ -324,7 +1022,14 @@ static void __do_simulation(void)
 	while (true) {
 		struct process *prev;
 
+		/* Take the checkpoint at the beginning of the tick */
+		if (checkpoint_at >= 0 && ticks == (unsigned int)checkpoint_at &&
+				!__do_checkpoint()) {
+			break;
+		}
+
 		/* Fork processes on schedule */
+		__feed_stream();
 		__fork_on_schedule();
 
 		/* Ask scheduler to pick the next process to run */
@@ -349,16 +1054,22 @@ static void __do_simulation(void)
 		if (!current) {
 			/* Quit simulation if no pending process exists */
 			if (list_empty(&readyqueue) && list_empty(&__forkqueue)) {
+				metrics.nr_deadlocked = __count_deadlocked();
 				break;
 			}
 
 			/* Idle temporarily */
-			fprintf(stderr, "%3d: idle\n", ticks);
+			if (!window || !quiet) {
+				fprintf(stderr, "%s%3d: idle\n", branch_tag, ticks);
+			}
 			goto next;
 		}
 
 		/* Execute the current process */
 		current->status = PROCESS_RUNNING;
+		if (current->__first_run_at < 0) {
+			current->__first_run_at = ticks;
+		}
 
 		/* Ensure that @current is detached from any list */
 		assert(list_empty(&current->list));
@@ -384,9 +1095,20 @@ static void __do_simulation(void)
 		}
 
 next:
+		__account_blocking();
+		__account_window();
+
 		/* Increase the tick counter */
 		ticks++;
 	}
+
+	metrics.makespan = ticks;
+	metrics.p99_waiting = __percentile_waiting(99);
+
+	/* Flush the last window, which ends with the last exit */
+	if (window && window_stats.starts_at <= ticks) {
+		__print_window(ticks);
+	}
 }
 
 
@@ -397,11 +1119,33 @@ static void __initialize(void)
 	for (int i = 0; i < NR_RESOURCES; i++) {
 		resources[i].owner = NULL;
 		INIT_LIST_HEAD(&(resources[i].waitqueue));
+		resources[i].ceiling = 0;
 	}
 
 	INIT_LIST_HEAD(&__forkqueue);
 
 	if (quiet) return;
+	if (nr_cpus) {
+		printf("**************************************************************\n");
+		printf("*\n");
+		printf("*   Simulating parallel jobs on %d CPUs\n", nr_cpus);
+		printf("*\n");
+		printf("**************************************************************\n");
+		printf("  p.t: Thread t of process p\n");
+		printf("    ~: Spinning on the barrier\n");
+		printf("\n");
+		return;
+	}
+	if (nr_cpu_configs) {
+		printf("**************************************************************\n");
+		printf("*\n");
+		printf("*   Simulating processes on heterogeneous CPUs\n");
+		printf("*\n");
+		printf("**************************************************************\n");
+		printf("    >: Migrated to the CPU\n");
+		printf("\n");
+		return;
+	}
 	printf("**************************************************************\n");
 	printf("*\n");
 	printf("*   Simulating %s scheduler\n", sched->name);
@@ -416,9 +1160,70 @@ static void __initialize(void)
 }
 
 
+static void __print_metrics(void)
+{
+	double nr = metrics.nr_processes ? metrics.nr_processes : 1;
+
+	printf("\n");
+	printf("     # of processes : %d\n", metrics.nr_processes);
+	printf(" Average turnaround : %.2f\n", metrics.turnaround / nr);
+	printf("    Average waiting : %.2f\n", metrics.waiting / nr);
+	/* No exit record in the streaming mode; see the windows for P99 */
+	if (!window) printf("        P99 waiting : %d\n", metrics.p99_waiting);
+	printf("   Average response : %.2f\n", metrics.response / nr);
+	printf("           Makespan : %d\n", metrics.makespan);
+	printf("   Average blocking : %.2f\n", metrics.blocking / nr);
+	if (metrics.nr_predictions) {
+		printf("   Prediction error : %.2f\n",
+				(double)metrics.prediction_error / metrics.nr_predictions);
+	}
+	if (metrics.nr_deadlocked) {
+		printf("         Deadlocked : %d (not in the metrics)\n",
+				metrics.nr_deadlocked);
+	}
+	if (window) return;
+
+	printf("\n");
+	printf("%s  pid  prio  turnaround  waiting  response  blocking\n", branch_tag);
+	for (int i = 0; i < nr_exit_records; i++) {
+		struct exit_record *er = exit_records + i;
+		printf("%s%5d %5d %11d %8d %9d %9d\n", branch_tag, er->pid, er->prio,
+				er->turnaround, er->waiting, er->response, er->blocking);
+	}
+}
+
+bool simulate(FILE *file, int opt, struct metrics *result)
+{
+	quiet = true;
+	sched = find_scheduler(opt);
+	sched_opt = opt;
+	if (!sched) return false;
+
+	__initialize();
+
+	if (__parse_script(file, -1) < 0) {
+		return false;
+	}
+
+	if (sched->initialize && sched->initialize()) {
+		return false;
+	}
+
+	__do_simulation();
+
+	if (sched->finalize) {
+		sched->finalize();
+	}
+
+	*result = metrics;
+	return true;
+}
+
+
 static void __print_usage(char * const name)
 {
-	printf("Usage: %s {-q} -[f|s|S|r|p|i] [process script file]\n", name);
+	printf("Usage: %s {-q} -[f|s|S|r|p|g|i|c|k|o|x|X] [process script file]\n", name);
+	printf("       %s {-q} -[f|s|S|r|p|g|i|c|k|o|x|X] -l [snapshot file]\n", name);
 	printf("\n");
 	printf("  -q: Run quietly\n\n");
 	printf("  -f: Use FIFO scheduler (default)\n");
@@ -426,8 +1231,41 @@ static void __print_usage(char * const name)
 	printf("  -S: Use SRTF scheduler\n");
 	printf("  -r: Use Round-robin scheduler\n");
 	printf("  -p: Use Priority scheduler\n");
+	printf("  -g: Use Priority scheduler with aging\n");
 	printf("  -c: Use Priority with PCP scheduler\n");
 	printf("  -i: Use Priority with PIP scheduler\n");
+	printf("  -k: Use Priority with immediate ceiling scheduler\n");
+	printf("  -o: Use Priority with original ceiling scheduler\n");
+	printf("  -x: Use SJF scheduler with predicted bursts\n");
+	printf("  -X: Use SRTF scheduler with predicted bursts\n");
+	printf("\n");
+	printf("  -a [alpha]   : Predict bursts by exponential averaging with @alpha\n");
+	printf("                 (default: 0.5)\n");
+	printf("  -A [ticks]   : Raise the priority of the ready processes by one for\n");
+	printf("                 every @ticks in the ready queue with -g (default: 5)\n");
+	printf("  -H           : Predict bursts with per-class histograms instead\n");
+	printf("  -m           : Print the metrics at the end of the simulation\n");
+	printf("\n");
+	printf("  -t [tick]    : Take a checkpoint at the beginning of @tick\n");
+	printf("  -w [file]    : Write the checkpoint into @file\n");
+	printf("  -b [options] : Branch into the schedulers in @options at the\n");
+	printf("                 checkpoint (e.g., -b rpc)\n");
+	printf("  -l [file]    : Restore the simulation from snapshot @file. The\n");
+	printf("                 scheduler in the snapshot is used unless specified\n");
+	printf("\n");
+	printf("  -M [file]    : Run Monte Carlo simulation with the workload spec @file\n");
+	printf("  -P [options] : Compare the schedulers in @options (default: fsSrpci)\n");
+	printf("  -j [number]  : Use @number workers (default: 4)\n");
+	printf("  -d [index]   : Print workload #@index of the spec instead\n");
+	printf("\n");
+	printf("  -W [ticks]   : Read the processes from the script while simulating,\n");
+	printf("                 and print the metrics of every @ticks. Give - as\n");
+	printf("                 the script to read from stdin\n");
+	printf("\n");
+	printf("  -n [cpus]    : Compare the gang scheduler with the uncoordinated one\n");
+	printf("                 for the parallel jobs on @cpus CPUs\n");
+	printf("  -C [speeds]  : Compare the placements on the CPUs of comma-separated\n");
+	printf("                 @speeds (e.g., -C 2,2 -C 1,1,1,1). Can be repeated\n");
 	printf("\n");
 }
 
@@ -435,35 +1273,98 @@ static void __print_usage(char * const name)
 int main(int argc, char * const argv[])
 {
 	int opt;
-	char *scriptfile;
-
-	while ((opt = getopt(argc, argv, "qfsSrpich")) != -1) {
+	char *scriptfile = NULL;
+	char *snapshotfile = NULL;
+	bool sched_specified = false;
+	char *specfile = NULL;
+	char *policies = "fsSrpci";
+	int nr_workers = 4;
+	int dump_index = -1;
+	bool print_metrics = false;
+
+	while ((opt = getopt(argc, argv, "qfsSrpgickoxXht:w:b:l:M:P:j:d:a:A:Hmn:C:W:")) != -1) {
 		switch (opt) {
 		case 'q':
 			quiet = true;
 			break;
 
 		case 'f':
-			sched = &fifo_scheduler;
-			break;
 		case 's':
-			sched = &sjf_scheduler;
-			break;
 		case 'S':
-			sched = &srtf_scheduler;
-			break;
 		case 'r':
-			sched = &rr_scheduler;
-			break;
 		case 'p':
-			sched = &prio_scheduler;
-			break;
+		case 'g':
 		case 'i':
-			sched = &pip_scheduler;
-			break;
 		case 'c':
-			sched = &pcp_scheduler;
+		case 'k':
+		case 'o':
+		case 'x':
+		case 'X':
+			sched = find_scheduler(opt);
+			sched_opt = opt;
+			sched_specified = true;
+			break;
+
+		case 't':
+			checkpoint_at = atoi(optarg);
+			break;
+		case 'w':
+			checkpoint_file = optarg;
 			break;
+		case 'b':
+			branch_policies = optarg;
+			break;
+		case 'l':
+			snapshotfile = optarg;
+			break;
+
+		case 'M':
+			specfile = optarg;
+			break;
+		case 'P':
+			policies = optarg;
+			break;
+		case 'j':
+			nr_workers = atoi(optarg);
+			break;
+		case 'd':
+			dump_index = atoi(optarg);
+			break;
+
+		case 'a':
+			predict_alpha = atof(optarg);
+			break;
+		case 'A':
+			aging_interval = atoi(optarg);
+			if (aging_interval == 0) {
+				fprintf(stderr, "Aging interval should be positive\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'H':
+			predict_histogram = true;
+			break;
+		case 'm':
+			print_metrics = true;
+			break;
+		case 'n':
+			nr_cpus = atoi(optarg);
+			break;
+		case 'W':
+			window = atoi(optarg);
+			if (window == 0) {
+				fprintf(stderr, "Window should be positive\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'C':
+			if (nr_cpu_configs == MAX_CPU_CONFIGS) {
+				fprintf(stderr, "Too many CPU configurations\n");
+				return EXIT_FAILURE;
+			}
+			cpu_configs[nr_cpu_configs++] = optarg;
+			break;
+
 		case 'h':
 		default:
 			__print_usage(argv[0]);
@@ -471,21 +1372,62 @@ int main(int argc, char * const argv[])
 		}
 	}
 
-	if (optind >= argc) {
+	if (specfile) {
+		if (dump_index >= 0) {
+			dump_workload(specfile, dump_index);
+			return EXIT_SUCCESS;
+		}
+		return run_montecarlo(specfile, policies, nr_workers > 0 ? nr_workers : 1);
+	}
+
+	if (optind < argc) {
+		scriptfile = argv[optind];
+	}
+
+	if ((!scriptfile && !snapshotfile) ||
+			((checkpoint_file || branch_policies) && checkpoint_at < 0) ||
+			((nr_cpus || nr_cpu_configs || window) &&
+			 (snapshotfile || checkpoint_at >= 0))) {
 		__print_usage(argv[0]);
 		return EXIT_FAILURE;
 	}
 
-	scriptfile = argv[optind];
+	if (window && !nr_cpus && !nr_cpu_configs) {
+		__initialize();
 
-	__initialize();
+		stream = strmatch(scriptfile, "-") ? stdin : fopen(scriptfile, "r");
+		if (!stream) {
+			fprintf(stderr, "Unable to open %s\n", scriptfile);
+			return EXIT_FAILURE;
+		}
+		window_stats.waiting = malloc(sizeof(*window_stats.waiting) * window);
 
-	if (!__load_script(scriptfile)) {
-		return EXIT_FAILURE;
-	}
+		if (sched->initialize && sched->initialize()) {
+			return EXIT_FAILURE;
+		}
+	} else if (snapshotfile) {
+		__initialize();
 
-	if (sched->initialize && sched->initialize()) {
-		return EXIT_FAILURE;
+		if (!__load_snapshot(snapshotfile, sched_specified)) {
+			return EXIT_FAILURE;
+		}
+	} else {
+		__initialize();
+
+		if (!__load_script(scriptfile)) {
+			return EXIT_FAILURE;
+		}
+
+		if (nr_cpus) {
+			return run_gang(&__forkqueue, nr_cpus);
+		}
+		if (nr_cpu_configs) {
+			return run_hetero(&__forkqueue, cpu_configs, nr_cpu_configs);
+		}
+
+		if (sched->initialize && sched->initialize()) {
+			return EXIT_FAILURE;
+		}
 	}
 
 	__do_simulation();
@@ -494,6 +1436,10 @@ int main(int argc, char * const argv[])
 		sched->finalize();
 	}
 
+	if (print_metrics) {
+		__print_metrics();
+	}
+
 	return EXIT_SUCCESS;
 }
 /*          ******        DO NOT MODIFY THIS FILE        ******       */
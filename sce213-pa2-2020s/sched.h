@@ -111,6 +111,33 @@ struct scheduler {
 	 *   Callbacked to release the resource @resource_id
 	 */
 	void (*release)(int);
+
+
+	/***********************************************************************
+	 * void checkpoint(FILE *file)
+	 *
+	 * DESCRIPTION
+	 *   Called when the framework takes a snapshot of the simulation. Write
+	 *   the policy-private state into @file, one "sched" line per item so
+	 *   that @restore() can get it back. Leave NULL if the policy keeps no
+	 *   state other than the ready queue and the resources.
+	 */
+	void (*checkpoint)(FILE *);
+
+
+	/***********************************************************************
+	 * bool restore(int nr_tokens, char *tokens[])
+	 *
+	 * DESCRIPTION
+	 *   Called for each "sched" line written by @checkpoint() when the
+	 *   simulation is restored from a snapshot taken under the same policy.
+	 *   @tokens[0] is "sched". @initialize() has been called beforehand.
+	 *
+	 * RETURN
+	 *   true if the line is restored successfully
+	 *   false otherwise, which aborts the restoration
+	 */
+	bool (*restore)(int, char *[]);
 };
 
 #endif
@@ -38,4 +38,104 @@ static inline int compare_and_swap(int *value, int old, int new)
 			: "memory" );
 	return old;
 }
+
+/**
+ * Add @inc to *@value atomically.
+ * Return the old value of *@value
+ */
+static inline int fetch_and_add(int *value, int inc)
+{
+	__asm__ volatile (
+		"lock ; xadd %0, %1"
+			: "+r"(inc), "+m"(*value)
+			:
+			: "memory" );
+	return inc;
+}
+
+/**
+ * Unsigned version of fetch_and_add(), which wraps around on overflow.
+ * Return the old value of *@value
+ */
+static inline unsigned int fetch_and_add_unsigned(unsigned int *value,
+		unsigned int inc)
+{
+	__asm__ volatile (
+		"lock ; xadd %0, %1"
+			: "+r"(inc), "+m"(*value)
+			:
+			: "memory" );
+	return inc;
+}
+
+/**
+ * Long version of compare_and_swap().
+ * Return the old value of *@value
+ */
+static inline long compare_and_swap_long(long *value, long old, long new)
+{
+	__asm__ volatile (
+		"lock ; cmpxchg %3, %1"
+			: "=a"(old), "+m"(*value)
+			: "a"(old), "r"(new)
+			: "memory" );
+	return old;
+}
+
+/**
+ * Set *@ptr to @new atomically.
+ * Return the old value of *@ptr
+ */
+static inline void *exchange_pointer(void **ptr, void *new)
+{
+	__asm__ volatile (
+		"xchg %0, %1"
+			: "+r"(new), "+m"(*ptr)
+			:
+			: "memory" );
+	return new;
+}
+
+/**
+ * Pointer version of compare_and_swap().
+ * Return the old value of *@ptr
+ */
+static inline void *compare_and_swap_pointer(void **ptr, void *old, void *new)
+{
+	__asm__ volatile (
+		"lock ; cmpxchg %3, %1"
+			: "=a"(old), "+m"(*ptr)
+			: "a"(old), "r"(new)
+			: "memory" );
+	return old;
+}
+
+/**
+ * Hint the processor that the caller is spinning. It saves the power and
+ * yields the pipeline to the sibling hyperthread.
+ */
+static inline void cpu_relax(void)
+{
+	__asm__ volatile ("pause" ::: "memory");
+}
+
+/**
+ * Order the memory accesses before this against the ones after this,
+ * including a store followed by a load which the processor may reorder
+ */
+static inline void smp_mb(void)
+{
+	__asm__ volatile ("mfence" ::: "memory");
+}
+
+/**
+ * Prevent the compiler from reordering the memory accesses across this
+ */
+#define barrier() __asm__ volatile ("" ::: "memory")
+
+/**
+ * Access @x in the memory every time rather than caching it in a register
+ */
+#define READ_ONCE(x)		(*(volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, v)	(*(volatile __typeof__(x) *)&(x) = (v))
 #endif
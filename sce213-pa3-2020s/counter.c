@@ -14,6 +14,8 @@
  **********************************************************************/
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
 #include <unistd.h>
 #include <string.h>
 #include <pthread.h>
@@ -21,52 +23,110 @@
 
 #include "types.h"
 #include "counter.h"
-
-static pthread_t counter_thread = 0;
+#include "topology.h"
+
+/**
+ * Each counter has its own histogram on its own cache lines so that the
+ * counters do not bounce the lines of each other. They are merged when
+ * the counting is over.
+ */
+struct counter {
+	pthread_t thread;
+	int id;
+	unsigned long nr_requests;	/* Requests to count by this counter */
+	unsigned long counted[MAX_VALUE];
+} __attribute__((aligned(64)));
+
+static struct counter *counters = NULL;
 
 static unsigned long nr_requests = 0;
-static unsigned long value_counter[MAX_VALUE] = { 0 };
 
 int counter_delay_usec = 0;
+int counter_batch = 1;
 
 int __dequeue_rb(void);
+int __dequeue_many_rb(int values[], int max);
 
 void *counter_main(void *_args_)
 {
-	if (verbose) printf("Counting %lu requests...\n", nr_requests);
-
-	for (unsigned long i = 0; i < nr_requests; i++) {
-		/* Take out a value from the ring buffer */
-		int value = __dequeue_rb();
+	struct counter *my = (struct counter *)_args_;
+	int values[counter_batch];
+	int nr_values = 0;
+	int next = 0;
+
+	pin_counter(my->id);
+
+	if (verbose) printf("Counter %d counting %lu requests...\n", my->id, my->nr_requests);
+
+	for (unsigned long i = 0; i < my->nr_requests; i++) {
+		int value;
+
+		/* Take out values from the ring buffer */
+		if (counter_batch == 1) {
+			value = __dequeue_rb();
+		} else {
+			if (next == nr_values) {
+				unsigned long left = my->nr_requests - i;
+				nr_values = __dequeue_many_rb(values,
+						left < (unsigned long)counter_batch ? left : (unsigned long)counter_batch);
+				next = 0;
+			}
+			value = values[next++];
+		}
 
 		/* Count it */
-		value_counter[value]++;
+		my->counted[value]++;
 
 		if (counter_delay_usec) usleep(counter_delay_usec);
 
-		if (verbose && i && i % (nr_requests >> 4) == 0) {
-			printf("Counter counted %lu / %lu (%lu%%)\n",
-					i, nr_requests, i * 100 / nr_requests);
+		if (verbose && i && i % (my->nr_requests >> 4) == 0) {
+			printf("Counter %d counted %lu / %lu (%lu%%)\n",
+					my->id, i, my->nr_requests, i * 100 / my->nr_requests);
 		}
 	}
 
-	if (verbose) printf("Counting finished...\n");
+	if (verbose) printf("Counter %d finished...\n", my->id);
 
 	return 0;
 }
 
 int spawn_counter(const enum counter_types type, const unsigned long _nr_requests_)
 {
+	void *buffer;
+
+	assert(nr_counters > 0);
 	nr_requests = _nr_requests_;
 
-	pthread_create(&counter_thread, NULL, counter_main, NULL);
+	if (posix_memalign(&buffer, 64, sizeof(struct counter) * nr_counters)) {
+		return -ENOMEM;
+	}
+	counters = buffer;
+	memset(counters, 0x00, sizeof(*counters) * nr_counters);
+
+	/* Split the requests evenly to the counters */
+	for (int i = 0; i < nr_counters; i++) {
+		struct counter *c = counters + i;
+		c->id = i;
+		c->nr_requests = nr_requests / nr_counters + ((unsigned long)i < nr_requests % nr_counters);
+	}
+	for (int i = 0; i < nr_counters; i++) {
+		pthread_create(&counters[i].thread, NULL, counter_main, counters + i);
+	}
 	return 0;
 }
 
 void fini_counter(unsigned long values[])
 {
-	if (counter_thread) {
-		pthread_join(counter_thread, NULL);
-		memcpy(values, value_counter, sizeof(unsigned long) * MAX_VALUE);
+	if (!counters) return;
+
+	for (int i = 0; i < nr_counters; i++) {
+		struct counter *c = counters + i;
+
+		pthread_join(c->thread, NULL);
+		for (int n = MIN_VALUE; n < MAX_VALUE; n++) {
+			values[n] += c->counted[n];
+		}
 	}
+	free(counters);
+	counters = NULL;
 }
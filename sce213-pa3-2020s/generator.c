@@ -15,19 +15,98 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
 #include <pthread.h>
+#include <time.h>
+#include <math.h>
 #include <assert.h>
 
 #include "types.h"
+#include "atomic.h"
+#include "histogram.h"
 #include "generator.h"
+#include "topology.h"
 
 /* Barrier to synchronize generators */
 static pthread_barrier_t barrier;
 
 int generator_delay_usec = 0;
+int generator_batch = 1;
+double generator_rate = 0;
+
+#define GENERATOR_SEED		0x5ce213UL
+#define GENERATOR_SPIN_NSEC	50000	/* Spin rather than sleep this close to a send */
+
+struct generator {
+	pthread_t thread;
+	int id;
+	int (*generator_fn)(int id);
+	uint64_t random[4];			/* State of xoshiro256** */
+	unsigned long *schedule;	/* Times to send at in the open loop */
+	unsigned long generated[MAX_VALUE];
+};
+static struct generator *generators = NULL;
+
+/* Time the generators have started at */
+static unsigned long started_at;
+
+
+/*********************************************************************
+ * Random numbers
+ *
+ * Each generator has a xoshiro256** generator of its own, seeded with
+ * splitmix64 from its id, instead of random() whose state is shared under
+ * a lock in glibc.
+ *********************************************************************/
+static uint64_t __splitmix64(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9e3779b97f4a7c15UL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9UL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebUL;
+	return z ^ (z >> 31);
+}
+
+static inline uint64_t __rotl(const uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+static uint64_t __next_random(uint64_t s[4])
+{
+	const uint64_t result = __rotl(s[1] * 5, 7) * 9;
+	const uint64_t t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = __rotl(s[3], 45);
+
+	return result;
+}
+
+static void __seed_random(uint64_t s[4], int id)
+{
+	uint64_t seed = GENERATOR_SEED + id;
+
+	for (int i = 0; i < 4; i++) {
+		s[i] = __splitmix64(&seed);
+	}
+}
+
+/**
+ * Return a random number in [0, 1)
+ */
+static double __next_uniform(uint64_t s[4])
+{
+	return (__next_random(s) >> 11) * 0x1.0p-53;
+}
+
 
 /* Assorted generator functions */
 int generator_fn_constant(int id)
@@ -38,7 +117,7 @@ int generator_fn_constant(int id)
 int generator_fn_random(int id)
 {
 	if (generator_delay_usec) usleep(generator_delay_usec);
-	return MIN_VALUE + (random() % (MAX_VALUE - MIN_VALUE));
+	return MIN_VALUE + (__next_random(generators[id].random) % (MAX_VALUE - MIN_VALUE));
 }
 
 int (*assign_generator_fn(int id, enum generator_types type))(int)
@@ -59,30 +138,92 @@ int (*assign_generator_fn(int id, enum generator_types type))(int)
 	assert(0);
 }
 
-struct generator {
-	pthread_t thread;
-	int id;
-	int (*generator_fn)(int id);
-	unsigned long generated[MAX_VALUE];
-};
-static struct generator *generators = NULL;
+
+/*********************************************************************
+ * Open loop
+ *
+ * With @generator_rate, the generators send the requests on a schedule
+ * made before they start, rather than as fast as the ring buffer takes
+ * them. The requests of a generator arrive in a Poisson process at its
+ * share of the rate, and a request held back behind the earlier ones is
+ * sent as soon as possible without being skipped. Its latency is taken
+ * from the time it is scheduled, so the time it has been held back is
+ * not omitted when the ring buffer falls behind the rate.
+ *********************************************************************/
+static void __make_schedule(struct generator *g)
+{
+	double gap_nsec = 1e9 * nr_generators / generator_rate;
+	double at = 0;
+
+	g->schedule = malloc(sizeof(*g->schedule) * nr_generate);
+	assert(g->schedule);
+
+	for (unsigned long i = 0; i < nr_generate; i++) {
+		at += -log(1 - __next_uniform(g->random)) * gap_nsec;
+		g->schedule[i] = at;
+	}
+}
+
+/**
+ * Wait until @at. Sleep until shortly before, and spin the rest not to
+ * oversleep
+ */
+static void __wait_until(unsigned long at)
+{
+	if (latency_now() + GENERATOR_SPIN_NSEC < at) {
+		unsigned long wake = at - GENERATOR_SPIN_NSEC;
+		struct timespec ts = {
+			.tv_sec = wake / 1000000000UL,
+			.tv_nsec = wake % 1000000000UL,
+		};
+
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+	}
+	while (latency_now() < at) {
+		cpu_relax();
+	}
+}
+
 
 void __enqueue_rb(int value);
+void __enqueue_many_rb(const int values[], int nr);
 
 void *generator_main(void *_args_)
 {
 	struct generator *my = (struct generator *)_args_;
+	int values[generator_batch];
+	int nr_values = 0;
+
+	pin_generator(my->id);
 
 	if (verbose) printf("Generator %d started...\n", my->id);
 
 	pthread_barrier_wait(&barrier); /* 1st barrier */
 
 	for (unsigned long i = 0; i < nr_generate; i++) {
+		int value;
+
+		/* Wait for the time to send. A batch is timed from its first one */
+		if (my->schedule) {
+			unsigned long at = started_at + my->schedule[i];
+
+			__wait_until(at);
+			if (nr_values == 0) intended_send_time = at;
+		}
+
 		/* Generate a number */
-		int value = my->generator_fn(my->id);
+		value = my->generator_fn(my->id);
 
-		/* The generator inserts the generated number into the ring buffer */
-		__enqueue_rb((int)value);
+		/* The generator inserts the generated numbers into the ring buffer */
+		if (generator_batch == 1) {
+			__enqueue_rb((int)value);
+		} else {
+			values[nr_values++] = value;
+			if (nr_values == generator_batch || i == nr_generate - 1) {
+				__enqueue_many_rb(values, nr_values);
+				nr_values = 0;
+			}
+		}
 
 		/* Account for the generated value */
 		my->generated[value]++;
@@ -92,6 +233,7 @@ void *generator_main(void *_args_)
 					my->id, i, nr_generate, i * 100 / nr_generate);
 		}
 	}
+	intended_send_time = 0;
 	if (verbose) printf("Generator %d finished...\n", my->id);
 
 	pthread_barrier_wait(&barrier); /* 2nd barrier */
@@ -117,9 +259,12 @@ int spawn_generators(const enum generator_types type)
 		struct generator *g = generators + i;
 		g->id = i;
 		g->generator_fn = assign_generator_fn(i, type);
+		__seed_random(g->random, i);
+		if (generator_rate > 0) __make_schedule(g);
 		pthread_create(&g->thread, NULL, generator_main, g);
 	}
 
+	started_at = latency_now();
 	pthread_barrier_wait(&barrier);	/* 1st barrier */
 
 	return 0;
@@ -151,6 +296,8 @@ void fini_generators(unsigned long values[])
 		if ((unsigned long)(g->thread) != 0) {
 			pthread_join(g->thread, NULL);
 		}
+		free(g->schedule);
 	}
 	free(generators);
+	pthread_barrier_destroy(&barrier);
 }
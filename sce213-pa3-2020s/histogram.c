@@ -0,0 +1,223 @@
+/**********************************************************************
+ * Copyright (c) 2020
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "types.h"
+#include "atomic.h"
+#include "list_head.h"
+#include "histogram.h"
+
+/*********************************************************************
+ * Log-linear buckets
+ *
+ * Latencies below 2^SUB_BITS nanoseconds get a bucket each. A larger one
+ * with the most significant bit at b >= SUB_BITS is shifted right by
+ * b - SUB_BITS + 1 into the 64 buckets of its power-of-two range, and the
+ * ranges are laid after one another.
+ *********************************************************************/
+#define SUB_BITS		7
+#define SUB_HALF		(1 << (SUB_BITS - 1))
+#define MAX_BITS		40		/* Clamp the latencies at 2^40 - 1 nsec */
+#define NR_BUCKETS		((MAX_BITS - SUB_BITS + 2) * SUB_HALF)
+
+struct histogram {
+	unsigned long counts[NR_BUCKETS];
+	unsigned long nr;
+	unsigned long max;
+};
+
+static int __bucket_of(unsigned long nsec)
+{
+	int shift;
+
+	if (nsec >= (1UL << MAX_BITS)) nsec = (1UL << MAX_BITS) - 1;
+	if (nsec < (1 << SUB_BITS)) return nsec;
+
+	shift = (63 - __builtin_clzl(nsec)) - (SUB_BITS - 1);
+	return (shift << (SUB_BITS - 1)) + (nsec >> shift);
+}
+
+/**
+ * Return the largest latency that falls in @bucket
+ */
+static unsigned long __highest_in(int bucket)
+{
+	int shift;
+
+	if (bucket < (1 << SUB_BITS)) return bucket;
+
+	shift = bucket / SUB_HALF - 1;
+	return ((unsigned long)(bucket - shift * SUB_HALF + 1) << shift) - 1;
+}
+
+
+/*********************************************************************
+ * Per-thread histograms
+ *
+ * The histograms of a thread are registered in @threads when the thread
+ * records for the first time, and never freed so that they can be merged
+ * after the thread exits.
+ *********************************************************************/
+struct thread_histograms {
+	struct histogram histograms[NR_LATENCY_TYPES];
+	struct list_head list;
+};
+
+bool measure_latency = false;
+__thread unsigned long intended_send_time = 0;
+
+static LIST_HEAD(threads);
+static int threads_lock = 0;
+static __thread struct thread_histograms *__self = NULL;
+
+static void __lock_threads(void)
+{
+	while (compare_and_swap(&threads_lock, 0, 1)) {
+		cpu_relax();
+	}
+}
+
+static void __unlock_threads(void)
+{
+	barrier();
+	WRITE_ONCE(threads_lock, 0);
+}
+
+void record_latency(enum latency_types type, unsigned long nsec)
+{
+	struct histogram *histogram;
+
+	if (!__self) {
+		__self = calloc(1, sizeof(*__self));
+		assert(__self);
+
+		__lock_threads();
+		list_add_tail(&__self->list, &threads);
+		__unlock_threads();
+	}
+
+	histogram = __self->histograms + type;
+	histogram->counts[__bucket_of(nsec)]++;
+	histogram->nr++;
+	if (nsec > histogram->max) histogram->max = nsec;
+}
+
+void reset_latencies(void)
+{
+	struct thread_histograms *thread;
+
+	__lock_threads();
+	list_for_each_entry(thread, &threads, list) {
+		memset(thread->histograms, 0x00, sizeof(thread->histograms));
+	}
+	__unlock_threads();
+}
+
+/**
+ * Return the latency at @percentile of @histogram
+ */
+static unsigned long __percentile(struct histogram *histogram, double percentile)
+{
+	unsigned long rank = histogram->nr * percentile / 100;
+	unsigned long seen = 0;
+
+	if (rank >= histogram->nr) rank = histogram->nr - 1;
+
+	for (int i = 0; i < NR_BUCKETS; i++) {
+		seen += histogram->counts[i];
+		if (seen > rank) {
+			unsigned long highest = __highest_in(i);
+			return highest < histogram->max ? highest : histogram->max;
+		}
+	}
+	return histogram->max;
+}
+
+/**
+ * Merge the histograms of all the threads into the ones of each type.
+ * The caller frees them
+ */
+static struct histogram *__merge_histograms(void)
+{
+	struct histogram *merged = calloc(NR_LATENCY_TYPES, sizeof(*merged));
+	struct thread_histograms *thread;
+
+	assert(merged);
+
+	__lock_threads();
+	list_for_each_entry(thread, &threads, list) {
+		for (int type = 0; type < NR_LATENCY_TYPES; type++) {
+			struct histogram *from = thread->histograms + type;
+			struct histogram *to = merged + type;
+
+			for (int i = 0; i < NR_BUCKETS; i++) {
+				to->counts[i] += from->counts[i];
+			}
+			to->nr += from->nr;
+			if (from->max > to->max) to->max = from->max;
+		}
+	}
+	__unlock_threads();
+	return merged;
+}
+
+void summarize_latencies(enum latency_types type, struct latency_summary *summary)
+{
+	struct histogram *merged = __merge_histograms();
+	struct histogram *histogram = merged + type;
+
+	memset(summary, 0x00, sizeof(*summary));
+	if (histogram->nr) {
+		summary->nr = histogram->nr;
+		summary->p50 = __percentile(histogram, 50);
+		summary->p99 = __percentile(histogram, 99);
+		summary->p999 = __percentile(histogram, 99.9);
+		summary->max = histogram->max;
+	}
+	free(merged);
+}
+
+void print_latencies(void)
+{
+	static const char *names[NR_LATENCY_TYPES] = {
+		[latency_spinlock_acquire] = "spinlock acquire",
+		[latency_mutex_acquire] = "mutex acquire",
+		[latency_ringbuffer] = "enqueue->dequeue",
+	};
+	struct histogram *merged = __merge_histograms();
+	bool header = false;
+
+	for (int type = 0; type < NR_LATENCY_TYPES; type++) {
+		struct histogram *histogram = merged + type;
+
+		if (!histogram->nr) continue;
+		if (!header) {
+			fprintf(stderr, "   %-16s %10s %10s %10s %10s %10s\n", "Latency (usec)",
+					"count", "p50", "p99", "p99.9", "max");
+			header = true;
+		}
+		fprintf(stderr, "   %-16s %10lu %10.2f %10.2f %10.2f %10.2f\n", names[type],
+				histogram->nr,
+				__percentile(histogram, 50) / 1e3,
+				__percentile(histogram, 99) / 1e3,
+				__percentile(histogram, 99.9) / 1e3,
+				histogram->max / 1e3);
+	}
+	free(merged);
+}
@@ -0,0 +1,93 @@
+/**********************************************************************
+ * Copyright (c) 2020
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include <time.h>
+
+/*************************************************
+ * Latency histograms
+ *
+ * Latencies are recorded in nanoseconds into the per-thread histograms of
+ * their types, and the histograms of all the threads are merged when they
+ * are reported. The histograms are log-linear as HDR histograms are; each
+ * power-of-two range is split into 64 buckets, so a latency is told within
+ * 1/64 of it from a nanosecond up to about 18 minutes.
+ */
+enum latency_types {
+	latency_spinlock_acquire = 0,
+	latency_mutex_acquire,
+	latency_ringbuffer,			/* From the enqueue to the dequeue of a value */
+	NR_LATENCY_TYPES,
+};
+
+/**
+ * Record the latencies only while this is set
+ */
+extern bool measure_latency;
+
+static inline unsigned long latency_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+/**
+ * Time the calling thread has meant to send its request at, set by the
+ * open-loop generators so that the latency includes the time the request
+ * has been held back behind the earlier ones. 0 to take the time the
+ * request is sent.
+ */
+extern __thread unsigned long intended_send_time;
+
+static inline unsigned long latency_send_time(void)
+{
+	return intended_send_time ? intended_send_time : latency_now();
+}
+
+/**
+ * Record @nsec into the histogram of @type of the calling thread
+ */
+void record_latency(enum latency_types type, unsigned long nsec);
+
+/**
+ * Clear the histograms of all the threads
+ */
+void reset_latencies(void);
+
+/**
+ * Merge the histograms of all the threads and print p50, p99, p99.9, and
+ * the maximum of each type that has any latency recorded. The threads
+ * should not be recording at the time.
+ */
+void print_latencies(void);
+
+/**
+ * Merge the histograms of @type of all the threads into @summary, in
+ * nanoseconds. The threads should not be recording at the time.
+ */
+struct latency_summary {
+	unsigned long nr;
+	unsigned long p50;
+	unsigned long p99;
+	unsigned long p999;
+	unsigned long max;
+};
+void summarize_latencies(enum latency_types type, struct latency_summary *summary);
+
+#endif
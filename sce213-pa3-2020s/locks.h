@@ -25,6 +25,58 @@ void acquire_spinlock(struct spinlock *);
 void release_spinlock(struct spinlock *);
 
 
+/*************************************************
+ * Ticket spinlock
+ */
+struct ticketlock;
+void init_ticketlock(struct ticketlock *);
+void acquire_ticketlock(struct ticketlock *);
+void release_ticketlock(struct ticketlock *);
+
+
+/*************************************************
+ * Test-and-test-and-set spinlock
+ */
+struct ttaslock;
+void init_ttaslock(struct ttaslock *);
+void acquire_ttaslock(struct ttaslock *);
+void release_ttaslock(struct ttaslock *);
+
+
+/*************************************************
+ * MCS queue spinlock
+ */
+struct mcslock;
+void init_mcslock(struct mcslock *);
+void acquire_mcslock(struct mcslock *);
+void release_mcslock(struct mcslock *);
+
+
+/*************************************************
+ * CLH queue spinlock
+ */
+struct clhlock;
+void init_clhlock(struct clhlock *);
+void acquire_clhlock(struct clhlock *);
+void release_clhlock(struct clhlock *);
+
+
+/*************************************************
+ * NUMA-aware cohort lock
+ */
+struct cohortlock;
+void init_cohortlock(struct cohortlock *);
+void acquire_cohortlock(struct cohortlock *);
+void release_cohortlock(struct cohortlock *);
+
+/**
+ * Get the numbers of the acquisitions following a holder on the same
+ * node and on another node
+ */
+void get_cohortlock_handoffs(struct cohortlock *,
+		unsigned long *nr_local, unsigned long *nr_remote);
+
+
 /*************************************************
  * Mutex
  */
@@ -33,4 +85,58 @@ void init_mutex(struct mutex *);
 void acquire_mutex(struct mutex *);
 void release_mutex(struct mutex *);
 
+void init_adaptive_mutex(struct mutex *);
+void acquire_adaptive_mutex(struct mutex *);
+void release_adaptive_mutex(struct mutex *);
+
+
+/*************************************************
+ * Condition variable on the mutex
+ */
+struct condvar;
+void init_condvar(struct condvar *);
+void wait_condvar(struct condvar *, struct mutex *);
+void signal_condvar(struct condvar *);
+void broadcast_condvar(struct condvar *);
+
+
+/*************************************************
+ * Reader-writer spinlock, preferring writers
+ */
+struct rwlock;
+void init_rwlock(struct rwlock *);
+void acquire_rwlock_read(struct rwlock *);
+void release_rwlock_read(struct rwlock *);
+void acquire_rwlock_write(struct rwlock *);
+void release_rwlock_write(struct rwlock *);
+
+
+/*************************************************
+ * Blocking reader-writer semaphore, preferring writers
+ */
+struct rwsem;
+void init_rwsem(struct rwsem *);
+void acquire_rwsem_read(struct rwsem *);
+void release_rwsem_read(struct rwsem *);
+void acquire_rwsem_write(struct rwsem *);
+void release_rwsem_write(struct rwsem *);
+
+
+/*************************************************
+ * Seqlock
+ *
+ * Readers retry while read_seqretry() returns true:
+ *
+ *	do {
+ *		sequence = read_seqbegin(lock);
+ *		... read the data ...
+ *	} while (read_seqretry(lock, sequence));
+ */
+struct seqlock;
+void init_seqlock(struct seqlock *);
+unsigned int read_seqbegin(struct seqlock *);
+bool read_seqretry(struct seqlock *, unsigned int sequence);
+void write_seqlock(struct seqlock *);
+void write_sequnlock(struct seqlock *);
+
 #endif
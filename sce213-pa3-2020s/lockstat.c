@@ -0,0 +1,323 @@
+/**********************************************************************
+ * Copyright (c) 2020
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <assert.h>
+
+#include "types.h"
+#include "atomic.h"
+#include "list_head.h"
+#include "lockstat.h"
+
+#ifdef CONFIG_LOCK_STAT
+
+/*********************************************************************
+ * Per-lock statistics
+ *
+ * A thread takes a shard by the order it first touches any lock. The
+ * threads beyond NR_SHARDS share the shards with the earlier ones, and
+ * the counts of the threads sharing a shard may be lost a little.
+ *
+ * A thread counts itself waiting in its own shard. Every contended
+ * acquisition reads the waiting counts of all the shards in use, and the
+ * shard keeps the largest sum it has seen; the shards are folded when
+ * they are dumped. So a waiter only reads the shared cache lines, and
+ * writes to no cache line but its own shard.
+ *********************************************************************/
+#define NR_SHARDS		64
+#define NR_TOP_LOCKS	10
+
+struct lock_stat_shard {
+	unsigned long nr_acquired;
+	unsigned long nr_contended;
+	unsigned long nr_spins;
+	unsigned long nr_parked;
+	unsigned long nr_unparked;
+	unsigned long hold_nsec;
+	unsigned long nr_held;			/* Holds accounted in @hold_nsec */
+	unsigned long acquired_at;		/* 0 if not holding the lock */
+	int nr_waiting;					/* Threads of the shard waiting now */
+	int max_waiting;				/* Most threads waiting at a time */
+} __attribute__((aligned(64)));
+
+struct lock_stat {
+	void *lock;
+	const char *kind;
+	const char *name;
+	struct list_head list;
+	struct lock_stat_shard shards[NR_SHARDS];
+};
+
+/* Totals of the shards of a lock for the dump */
+struct lock_stat_sum {
+	struct lock_stat *stat;
+	struct lock_stat_shard total;
+};
+
+static LIST_HEAD(lock_stats);
+static int lock_stats_lock = 0;
+static int nr_threads = 0;
+static __thread int __shard = -1;
+
+static void __lock_stats(void)
+{
+	while (compare_and_swap(&lock_stats_lock, 0, 1)) {
+		cpu_relax();
+	}
+}
+
+static void __unlock_stats(void)
+{
+	barrier();
+	WRITE_ONCE(lock_stats_lock, 0);
+}
+
+static struct lock_stat_shard *__get_shard(struct lock_stat *stat)
+{
+	if (__shard < 0) {
+		__shard = fetch_and_add(&nr_threads, 1) % NR_SHARDS;
+	}
+	return stat->shards + __shard;
+}
+
+static unsigned long __now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+struct lock_stat *register_lock_stat(void *lock, const char *kind)
+{
+	struct lock_stat *stat;
+
+	__lock_stats();
+	list_for_each_entry(stat, &lock_stats, list) {
+		if (stat->lock == lock) goto out;
+	}
+
+	/* Never freed; the lock may be used until the process exits */
+	if (posix_memalign((void **)&stat, 64, sizeof(*stat))) {
+		stat = NULL;
+		goto out;
+	}
+	memset(stat, 0x00, sizeof(*stat));
+	stat->lock = lock;
+	list_add_tail(&stat->list, &lock_stats);
+out:
+	if (stat) stat->kind = kind;
+	__unlock_stats();
+	assert(stat);
+	return stat;
+}
+
+void name_lock_stat(void *lock, const char *name)
+{
+	struct lock_stat *stat;
+
+	__lock_stats();
+	list_for_each_entry(stat, &lock_stats, list) {
+		if (stat->lock == lock) stat->name = name;
+	}
+	__unlock_stats();
+}
+
+void lock_stat_contended(struct lock_stat *stat)
+{
+	struct lock_stat_shard *shard = __get_shard(stat);
+	int nr_shards = READ_ONCE(nr_threads);
+	int nr_waiting = 0;
+
+	/* Atomic only for the threads sharing the shard */
+	fetch_and_add(&shard->nr_waiting, 1);
+
+	if (nr_shards > NR_SHARDS) nr_shards = NR_SHARDS;
+	for (int i = 0; i < nr_shards; i++) {
+		nr_waiting += READ_ONCE(stat->shards[i].nr_waiting);
+	}
+	if (nr_waiting > shard->max_waiting) shard->max_waiting = nr_waiting;
+}
+
+void lock_stat_acquired(struct lock_stat *stat, bool contended, unsigned long spins)
+{
+	struct lock_stat_shard *shard = __get_shard(stat);
+
+	if (contended) {
+		fetch_and_add(&shard->nr_waiting, -1);
+		shard->nr_contended++;
+	}
+	shard->nr_acquired++;
+	shard->nr_spins += spins;
+	shard->acquired_at = __now();
+}
+
+void lock_stat_released(struct lock_stat *stat)
+{
+	struct lock_stat_shard *shard = __get_shard(stat);
+
+	if (!shard->acquired_at) return;
+
+	shard->hold_nsec += __now() - shard->acquired_at;
+	shard->nr_held++;
+	shard->acquired_at = 0;
+}
+
+void lock_stat_parked(struct lock_stat *stat)
+{
+	__get_shard(stat)->nr_parked++;
+}
+
+void lock_stat_unparked(struct lock_stat *stat)
+{
+	__get_shard(stat)->nr_unparked++;
+}
+
+
+/*********************************************************************
+ * Dump
+ *********************************************************************/
+static int __compare_contention(const void *_a_, const void *_b_)
+{
+	const struct lock_stat_sum *a = _a_, *b = _b_;
+
+	if (a->total.nr_contended != b->total.nr_contended) {
+		return a->total.nr_contended < b->total.nr_contended ? 1 : -1;
+	}
+	if (a->total.nr_acquired != b->total.nr_acquired) {
+		return a->total.nr_acquired < b->total.nr_acquired ? 1 : -1;
+	}
+	return 0;
+}
+
+/**
+ * Print the statistics of the @nr_top locks contended most. The counters
+ * are read while the threads may be updating them, so a dump in the
+ * middle of a run is a rough snapshot.
+ */
+static void __dump_lock_stats(int nr_top)
+{
+	struct lock_stat *stat;
+	struct lock_stat_sum *sums;
+	int nr_locks = 0;
+
+	__lock_stats();
+	list_for_each_entry(stat, &lock_stats, list) {
+		nr_locks++;
+	}
+	sums = calloc(nr_locks ? nr_locks : 1, sizeof(*sums));
+
+	nr_locks = 0;
+	list_for_each_entry(stat, &lock_stats, list) {
+		struct lock_stat_sum *sum = sums + nr_locks++;
+
+		sum->stat = stat;
+		for (int i = 0; i < NR_SHARDS; i++) {
+			struct lock_stat_shard *shard = stat->shards + i;
+
+			sum->total.nr_acquired += shard->nr_acquired;
+			sum->total.nr_contended += shard->nr_contended;
+			sum->total.nr_spins += shard->nr_spins;
+			sum->total.nr_parked += shard->nr_parked;
+			sum->total.nr_unparked += shard->nr_unparked;
+			sum->total.hold_nsec += shard->hold_nsec;
+			sum->total.nr_held += shard->nr_held;
+			if (shard->max_waiting > sum->total.max_waiting) {
+				sum->total.max_waiting = shard->max_waiting;
+			}
+		}
+	}
+	__unlock_stats();
+
+	qsort(sums, nr_locks, sizeof(*sums), __compare_contention);
+	if (nr_locks > nr_top) nr_locks = nr_top;
+
+	/* The locks never acquired are sorted to the end */
+	while (nr_locks && !sums[nr_locks - 1].total.nr_acquired) {
+		nr_locks--;
+	}
+	if (!nr_locks) {
+		free(sums);
+		return;
+	}
+
+	fprintf(stderr, "\nLocks contended most\n");
+	fprintf(stderr, "%-20s %-9s %12s %12s %14s %10s %10s %10s %8s\n",
+			"Lock", "Kind", "Acquired", "Contended", "Spins",
+			"Parked", "Unparked", "Hold(us)", "Waiters");
+	for (int i = 0; i < nr_locks; i++) {
+		struct lock_stat_sum *sum = sums + i;
+		char address[24], hold[16] = "-";
+		const char *name = sum->stat->name;
+
+		if (!name) {
+			snprintf(address, sizeof(address), "%p", sum->stat->lock);
+			name = address;
+		}
+		/* No hold time for the mutexes used as semaphores */
+		if (sum->total.nr_held) {
+			snprintf(hold, sizeof(hold), "%.3f",
+					sum->total.hold_nsec / 1e3 / sum->total.nr_held);
+		}
+		fprintf(stderr, "%-20s %-9s %12lu %12lu %14lu %10lu %10lu %10s %8d\n",
+				name, sum->stat->kind,
+				sum->total.nr_acquired, sum->total.nr_contended, sum->total.nr_spins,
+				sum->total.nr_parked, sum->total.nr_unparked, hold,
+				sum->total.max_waiting);
+	}
+	free(sums);
+}
+
+static void __dump_at_exit(void)
+{
+	__dump_lock_stats(NR_TOP_LOCKS);
+}
+
+/**
+ * SIGUSR1 is blocked in all the threads and taken here, so the dump runs
+ * in a thread context rather than in a signal handler
+ */
+static void *__dump_on_signal(void *_set_)
+{
+	sigset_t *set = _set_;
+	int signo;
+
+	while (true) {
+		if (sigwait(set, &signo) == 0) __dump_lock_stats(NR_TOP_LOCKS);
+	}
+	return NULL;
+}
+
+void init_lock_stats(void)
+{
+	static sigset_t set;
+	pthread_t thread;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	pthread_create(&thread, NULL, __dump_on_signal, &set);
+	pthread_detach(thread);
+
+	atexit(__dump_at_exit);
+}
+
+#endif
@@ -0,0 +1,104 @@
+/**********************************************************************
+ * Copyright (c) 2020
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __LOCKSTAT_H__
+#define __LOCKSTAT_H__
+
+/*************************************************
+ * Lock statistics
+ *
+ * Built with CONFIG_LOCK_STAT (make LOCK_STAT=1), spinlocks and mutexes
+ * keep the statistics of their acquisitions, and the locks contended most
+ * are dumped at exit or when the process gets SIGUSR1. The hooks compile
+ * to nothing otherwise. Each lock keeps the counters in the shards of the
+ * threads updating them, so the statistics do not add another contended
+ * cache line to the lock.
+ */
+struct lock_stat;
+
+#ifdef CONFIG_LOCK_STAT
+
+#define lock_stat_of(lock)	((lock)->stat)
+
+/**
+ * Return the statistics of @lock of @kind, registering it if it is new.
+ * A lock initialized again at the same address keeps counting on its
+ * statistics.
+ */
+struct lock_stat *register_lock_stat(void *lock, const char *kind);
+
+/**
+ * Name the lock at @lock in the dump
+ */
+void name_lock_stat(void *lock, const char *name);
+
+/**
+ * Called when the calling thread finds the lock held and starts waiting
+ */
+void lock_stat_contended(struct lock_stat *stat);
+
+/**
+ * Called when the calling thread gets the lock after spinning for @spins
+ * iterations. @contended tells whether lock_stat_contended() preceded
+ */
+void lock_stat_acquired(struct lock_stat *stat, bool contended, unsigned long spins);
+
+/**
+ * Called when the calling thread releases the lock. The hold time is
+ * accounted only when the thread has acquired the lock itself; a mutex
+ * used as a semaphore is often released by another thread.
+ */
+void lock_stat_released(struct lock_stat *stat);
+
+void lock_stat_parked(struct lock_stat *stat);
+void lock_stat_unparked(struct lock_stat *stat);
+
+/**
+ * Dump the locks contended most at exit and on SIGUSR1. Call from the
+ * main thread before spawning any thread, which inherits the blocked
+ * SIGUSR1 from it.
+ */
+void init_lock_stats(void);
+
+#else
+
+#define lock_stat_of(lock)	NULL
+
+static inline struct lock_stat *register_lock_stat(void *lock, const char *kind)
+{
+	(void)lock;
+	(void)kind;
+	return NULL;
+}
+static inline void name_lock_stat(void *lock, const char *name)
+{
+	(void)lock;
+	(void)name;
+}
+static inline void lock_stat_contended(struct lock_stat *stat) { (void)stat; }
+static inline void lock_stat_acquired(struct lock_stat *stat, bool contended, unsigned long spins)
+{
+	(void)stat;
+	(void)contended;
+	(void)spins;
+}
+static inline void lock_stat_released(struct lock_stat *stat) { (void)stat; }
+static inline void lock_stat_parked(struct lock_stat *stat) { (void)stat; }
+static inline void lock_stat_unparked(struct lock_stat *stat) { (void)stat; }
+static inline void init_lock_stats(void) {}
+
+#endif
+
+#endif
@@ -18,7 +18,10 @@
 #include <unistd.h>
 #include <errno.h>
 #include <pthread.h>
+#include <string.h>
 #include <sys/time.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 #include <assert.h>
 
 #include "types.h"
@@ -26,12 +29,20 @@
 #include "locks.h"
 #include "generator.h"
 #include "counter.h"
+#include "histogram.h"
+#include "lockstat.h"
+#include "topology.h"
 
 /*************************************************
  * Lock tester.
  * Will be invoked if the program is run with -T
  */
-void test_lock(enum lock_types);
+int test_lock(enum lock_types);
+int test_rwlocks(const char *percents);
+int bench_locks(FILE *csv, int only, int nr_trials);
+void summarize_trials(const double samples[], int nr, double *mean, double *stddev);
+int find_lock_type(const char *name);
+void print_lock_types(void);
 
 /* Common */
 int verbose = 1;
@@ -39,6 +50,7 @@ int verbose = 1;
 /* Generator */
 static enum generator_types generator_type = generator_constant;
 int nr_generators = 1;
+int nr_counters = 1;
 unsigned long nr_generate = 128;
 
 /* Counter */
@@ -47,11 +59,26 @@ static enum counter_types counter_type = counter_normal;
 /* Ring buffer */
 static int nr_slots = 64;
 
+/* Batch sizes and ring buffer sizes to sweep over */
+static bool sweep_batches = false;
+static const int sweep_batch_sizes[] = { 1, 4, 16, 64 };
+static const int sweep_nr_slots[] = { 4, 16, 64, 256 };
+#define NR_SWEEP_BATCH_SIZES	((int)(sizeof(sweep_batch_sizes) / sizeof(*sweep_batch_sizes)))
+#define NR_SWEEP_NR_SLOTS		((int)(sizeof(sweep_nr_slots) / sizeof(*sweep_nr_slots)))
+
+/* Benchmark */
+static const char *bench_target = NULL;		/* "lock", "ring", or "load" */
+static const char *bench_output = NULL;		/* CSV file. stdout if NULL */
+static int bench_lock = -1;					/* Lock to benchmark. All if -1 */
+static int nr_bench_trials = 5;
+
 /*********************************************************************
  * Common implementation
  */
 void enqueue_into_ringbuffer(int value);
 int dequeue_from_ringbuffer(void);
+void enqueue_many_into_ringbuffer(const int values[], int nr);
+int dequeue_many_from_ringbuffer(int values[], int max);
 void fini_ringbuffer(void);
 int init_ringbuffer(const int nr_slots);
 
@@ -71,6 +98,27 @@ int __dequeue_rb(void)
 	return value;
 }
 
+void __enqueue_many_rb(const int values[], int nr)
+{
+	for (int i = 0; i < nr; i++) {
+		assert(values[i] >= MIN_VALUE && values[i] < MAX_VALUE);
+	}
+	enqueue_many_into_ringbuffer(values, nr);
+}
+
+int __dequeue_many_rb(int values[], int max)
+{
+	int nr;
+
+	nr = dequeue_many_from_ringbuffer(values, max);
+	assert(nr > 0 && nr <= max);
+	for (int i = 0; i < nr; i++) {
+		assert(values[i] >= MIN_VALUE && values[i] < MAX_VALUE);
+	}
+
+	return nr;
+}
+
 static int __init_rb(const int _nr_slots_)
 {
 	assert(_nr_slots_ > 0);
@@ -89,15 +137,50 @@ static void __print_usage(const char *argv0)
 	printf(" Run with -l or -m to check the correctness of the lock implementation\n");
 	printf("  -l         : Test spinlock implementation\n");
 	printf("  -m         : Torture blocking mutex\n");
+	printf("  -L [name]  : Test lock @name;");
+	print_lock_types();
+	printf("\n");
+	printf("  -W [list]  : Compare reader-writer locks with the mutex at the comma-separated\n");
+	printf("               percentages of writes, with 1, 2, 4, ... up to -t threads\n");
+	printf("  -t [number]: Torture the lock with @number threads (default: 4)\n");
+	printf("  -d [sec]   : Torture the lock for @sec seconds (default: 5)\n");
+	printf("  -p         : Measure the performance only\n");
+	printf("  -b [number]: Spin @number pauses in adaptive mutexes before parking (default: 4096)\n");
 	printf("\n");
 	printf(" Run with -r to check the ring buffer implementation\n");
 	printf("  -g [number]: Spawn @number generators for test\n");
 	printf("  -n [number]: Generate @number requests per generator\n");
+	printf("  -c [number]: Spawn @number counters for test\n");
 	printf("  -R         : Use random generator rather than constant generator\n");
 	printf("  -s [number]: Set the number of slots in the ring buffer\n");
 	printf("  -0         : Comprehensive test with realistic values\n");
 	printf("  -1         : Test full ring buffer\n");
 	printf("  -2         : Test empty ring buffer\n");
+	printf("  -a         : Build the ring buffer with adaptive mutexes\n");
+	printf("  -f         : Use the lock-free ring buffer\n");
+	printf("  -S         : Use the ring buffer sharded for each generator\n");
+	printf("  -P         : Use the ring buffer with the indices on their own cache lines\n");
+	printf("  -C         : Use the ring buffer on a mutex and condition variables\n");
+	printf("  -E [number]: Enqueue @number values at once in generators (default: 1)\n");
+	printf("  -D [number]: Dequeue up to @number values at once in counter (default: 1)\n");
+	printf("  -B         : Sweep the batch sizes and the number of slots\n");
+	printf("  -O [rate]  : Generate @rate requests/sec in total in an open loop, and report\n");
+	printf("               the latencies from the times the requests are scheduled at\n");
+	printf("  -A [name]  : Pin generators and counters by placement @name;\n");
+	printf("               compact, scatter, smt, or cross\n");
+	printf("\n");
+	printf(" Run with -x to benchmark and write the results in CSV\n");
+	printf("  -x lock    : Sweep the locks, 1 to -t threads, critical section lengths, and think times\n");
+	printf("               Only the lock given with -L, -l, or -m if any\n");
+	printf("  -x ring    : Sweep 1 to -g generators, the number of slots, and the batch sizes\n");
+	printf("               on the ring buffer chosen with -a, -f, -S, -P, or -C\n");
+	printf("  -x load    : Sweep the offered load from 10%% to 100%% of -O rate in the open\n");
+	printf("               loop, once for each point\n");
+	printf("  -T [number]: Repeat @number trials after a warmup for each point (default: 5)\n");
+	printf("  -o [file]  : Write the CSV into @file rather than stdout\n");
+	printf("\n");
+	printf("  -H         : Report the latencies of acquiring spinlocks and mutexes, and\n");
+	printf("               from the enqueue to the dequeue of the values in the ring buffer\n");
 	printf("\n");
 	printf("  -h | -?    : Print usage\n");
 	printf("  -v | -q    : Make verbose or quiet\n");
@@ -111,8 +194,9 @@ int parse_options(int argc, char * const argv[])
 	bool test_locks = false;
 	bool test_ringbuffer = false;
 	enum lock_types lock_type = lock_spinlock;
+	const char *rw_percents = NULL;
 
-	while ((opt = getopt(argc, argv, "vqg:s:n:RrSml012h?")) != -1) {
+	while ((opt = getopt(argc, argv, "vqg:s:n:c:RrSPCmlL:W:t:d:pb:afE:D:BA:O:x:T:o:H012h?")) != -1) {
 		switch(opt) {
 		case 'v':
 			verbose = 1;
@@ -122,6 +206,8 @@ int parse_options(int argc, char * const argv[])
 			break;
 		case 'l':
 			test_locks = true;
+			lock_type = lock_spinlock;
+			bench_lock = lock_type;
 			break;
 		case 'r':
 			test_ringbuffer = true;
@@ -135,9 +221,90 @@ int parse_options(int argc, char * const argv[])
 		case 'n':
 			nr_generate = atoll(optarg);
 			break;
+		case 'c':
+			nr_counters = atoi(optarg);
+			break;
 		case 'm':
 			test_locks = true;
 			lock_type = lock_mutex;
+			bench_lock = lock_type;
+			break;
+		case 'L':
+			test_locks = true;
+			if ((lock_type = find_lock_type(optarg)) < 0) {
+				fprintf(stderr, "Unknown lock %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			bench_lock = lock_type;
+			break;
+		case 'W':
+			rw_percents = optarg;
+			break;
+		case 't':
+			nr_testers = atoi(optarg);
+			break;
+		case 'd':
+			testing_duration_sec = atoi(optarg);
+			break;
+		case 'p':
+			test_performance_only = true;
+			break;
+		case 'b':
+			mutex_spin_budget = atoi(optarg);
+			break;
+		case 'a':
+			adaptive_mutex = true;
+			break;
+		case 'f':
+			lockfree_ringbuffer = true;
+			break;
+		case 'S':
+			sharded_ringbuffer = true;
+			break;
+		case 'P':
+			padded_ringbuffer = true;
+			break;
+		case 'C':
+			condvar_ringbuffer = true;
+			break;
+		case 'E':
+			generator_batch = atoi(optarg);
+			break;
+		case 'D':
+			counter_batch = atoi(optarg);
+			break;
+		case 'B':
+			test_ringbuffer = true;
+			sweep_batches = true;
+			break;
+		case 'A':
+			if ((placement = find_placement(optarg)) < 0) {
+				fprintf(stderr, "Unknown placement %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'O': {
+			char *end;
+
+			generator_rate = strtod(optarg, &end);
+			if (end == optarg || *end || generator_rate <= 0) {
+				fprintf(stderr, "Invalid rate %s; need a positive number\n", optarg);
+				return EXIT_FAILURE;
+			}
+			measure_latency = true;
+			break;
+		}
+		case 'x':
+			bench_target = optarg;
+			break;
+		case 'H':
+			measure_latency = true;
+			break;
+		case 'T':
+			nr_bench_trials = atoi(optarg);
+			break;
+		case 'o':
+			bench_output = optarg;
 			break;
 		case 's':
 			nr_slots = atoi(optarg);
@@ -174,13 +341,39 @@ int parse_options(int argc, char * const argv[])
 		}
 	}
 
+	if (nr_counters < 1) {
+		fprintf(stderr, "Need one or more counters\n");
+		return EXIT_FAILURE;
+	}
+	if (generator_batch < 1 || counter_batch < 1) {
+		fprintf(stderr, "Batch sizes should be positive\n");
+		return EXIT_FAILURE;
+	}
+	if (bench_target) {
+		if (strcmp(bench_target, "lock") && strcmp(bench_target, "ring") &&
+				strcmp(bench_target, "load")) {
+			fprintf(stderr, "Unknown benchmark %s\n", bench_target);
+			return EXIT_FAILURE;
+		}
+		if (strcmp(bench_target, "load") == 0 && generator_rate <= 0) {
+			fprintf(stderr, "Need the rate to sweep up to with -O\n");
+			return EXIT_FAILURE;
+		}
+		if (nr_bench_trials < 1) {
+			fprintf(stderr, "Need one or more trials\n");
+			return EXIT_FAILURE;
+		}
+		return 0;
+	}
+	if (rw_percents) {
+		exit(test_rwlocks(rw_percents));
+	}
 	if (!test_locks && !test_ringbuffer) {
 		__print_usage(argv[0]);
 		return EXIT_FAILURE;
 	}
 	if (test_locks) {
-		test_lock(lock_type);
-		exit(0);
+		exit(test_lock(lock_type));
 	}
 	return 0;
 }
@@ -208,7 +401,55 @@ void compare_results(unsigned long generated_values[], unsigned long counted_val
 	printf("\n");
 }
 
-int main(int argc, char * const argv[])
+/**
+ * Open a counter of the cache misses of the calling thread and the threads
+ * spawned after. Return the file descriptor or -1 if the hardware counters
+ * are not available.
+ */
+static int __open_cache_misses(void)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0x00, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.inherit = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/**
+ * Read the counter in @fd after the spawned threads are joined; they add up
+ * their counts to it when they exit. Return -1 if @fd is not opened.
+ */
+static long long __read_cache_misses(int fd)
+{
+	long long count;
+
+	if (fd < 0) return -1;
+	if (read(fd, &count, sizeof(count)) != sizeof(count)) count = -1;
+	close(fd);
+	return count;
+}
+
+static bool __results_match(unsigned long generated_values[], unsigned long counted_values[])
+{
+	for (int i = MIN_VALUE; i < MAX_VALUE; i++) {
+		if (generated_values[i] != counted_values[i]) return false;
+	}
+	return true;
+}
+
+/**
+ * Run generators and counter over the ring buffer once. Print the result
+ * if @report, and put the performance in req/sec into @performance and
+ * the cache misses per request into @misses, which is negative if the
+ * hardware counters are not available.
+ */
+static int __run_ringbuffer(bool report, double *performance, double *misses)
 {
 	int retval = EXIT_SUCCESS;
 	unsigned long generated_values[MAX_VALUE] = {0};
@@ -217,27 +458,28 @@ int main(int argc, char * const argv[])
 
 	struct timeval start, end;
 	unsigned long elapsed;
+	int perf_fd;
+	long long nr_misses;
 
-	__print_message("\n");
-	__print_message(" _               _      _____         _            \n");
-	__print_message("| |    ___   ___| | __ |_   _|__  ___| |_ ___ _ __ \n");
-	__print_message("| |   / _ \\ / __| |/ /   | |/ _ \\/ __| __/ _ \\ '__|\n");
-	__print_message("| |__| (_) | (__|   <    | |  __/\\__ \\ ||  __/ |   \n");
-	__print_message("|_____\\___/ \\___|_|\\_\\   |_|\\___||___/\\__\\___|_|\n");
-	__print_message("\n");
-	__print_message("                                    2020 Spring\n");
-	__print_message("\n");
-
-	if ((retval = parse_options(argc, argv))) {
-		goto exit;
-	}
 	if ((retval = __init_rb(nr_slots))) {
-		goto exit;
+		return retval;
 	}
 
 	nr_requests_to_generate = nr_generate * nr_generators;
 
+	if (plan_placement(nr_generators, nr_counters)) {
+		fprintf(stderr, "Cannot read the CPU topology\n");
+		retval = EXIT_FAILURE;
+		goto exit_ring;
+	}
+
+	reset_latencies();
+
+	/* Count before spawning the threads so that they inherit the counter */
+	perf_fd = __open_cache_misses();
+
 	if ((retval = spawn_counter(counter_type, nr_requests_to_generate))) {
+		if (perf_fd >= 0) close(perf_fd);
 		goto exit_ring;
 	}
 
@@ -251,16 +493,262 @@ int main(int argc, char * const argv[])
 
 	fini_generators(generated_values);
 	fini_counter(counted_values);
+	nr_misses = __read_cache_misses(perf_fd);
+
+	*performance = (double)nr_requests_to_generate * 1000000 / elapsed;
+	*misses = nr_misses < 0 ? -1 : (double)nr_misses / nr_requests_to_generate;
+
+	if (!report) {
+		if (!__results_match(generated_values, counted_values)) retval = EXIT_FAILURE;
+		goto exit_ring;
+	}
 
 	compare_results(generated_values, counted_values);
 	printf(         "     # of requests : %lu\n", nr_requests_to_generate);
 	printf(         "  Time to complete : %lu.%06lu\n", elapsed / 1000000, elapsed % 1000000);
-	fprintf(stderr, "       Performance : %.1f req/sec\n",
-			(float)nr_requests_to_generate * 1000000 / elapsed);
+	if (generator_rate > 0) {
+		fprintf(stderr, "      Offered load : %.1f req/sec\n", generator_rate);
+	}
+	fprintf(stderr, "       Performance : %.1f req/sec\n", *performance);
+	if (placement != placement_none) {
+		fprintf(stderr, "         Placement : %s on %s\n", placement_name(), describe_topology());
+		fprintf(stderr, "                     %s\n", describe_placement());
+	}
+	if (nr_misses < 0) {
+		fprintf(stderr, "      Cache misses : n/a (no hardware counter)\n");
+	} else {
+		fprintf(stderr, "      Cache misses : %lld (%.2f/req)\n", nr_misses, *misses);
+	}
+	if (condvar_ringbuffer) {
+		fprintf(stderr, "           Wakeups : %lu (%lu saved)\n",
+				nr_ringbuffer_wakeups, nr_ringbuffer_wakeups_saved);
+	}
+	if (measure_latency) print_latencies();
 	printf("\n");
 
 exit_ring:
 	__fini_rb();
-exit:
 	return retval;
 }
+
+/**
+ * Run the ring buffer with the batch sizes and the numbers of slots in
+ * @sweep_batch_sizes and @sweep_nr_slots, and print req/sec of each. The
+ * cache misses per request follow if the hardware counters are available.
+ */
+static void __print_sweep_header(const char *title)
+{
+	printf("%-8s", title);
+	for (int j = 0; j < NR_SWEEP_NR_SLOTS; j++) {
+		printf(" %8d slots", sweep_nr_slots[j]);
+	}
+	printf("\n");
+}
+
+static int __sweep_batches(void)
+{
+	double performance;
+	double misses[NR_SWEEP_BATCH_SIZES][NR_SWEEP_NR_SLOTS];
+	bool counted = true;
+
+	verbose = 0;
+
+	__print_sweep_header("Batch");
+	for (int i = 0; i < NR_SWEEP_BATCH_SIZES; i++) {
+		generator_batch = counter_batch = sweep_batch_sizes[i];
+
+		printf("%-8d", sweep_batch_sizes[i]);
+		for (int j = 0; j < NR_SWEEP_NR_SLOTS; j++) {
+			nr_slots = sweep_nr_slots[j];
+			if (__run_ringbuffer(false, &performance, &misses[i][j])) {
+				printf("\n");
+				fprintf(stderr, ">>> The ring buffer is **NOT** working properly "
+						"with batch %d on %d slots!! <<<\n", generator_batch, nr_slots);
+				return EXIT_FAILURE;
+			}
+			if (misses[i][j] < 0) counted = false;
+			printf(" %14.1f", performance);
+			fflush(stdout);
+		}
+		printf("\n");
+	}
+
+	printf("\n");
+	if (!counted) {
+		printf("Cache misses: n/a (no hardware counter)\n");
+		return EXIT_SUCCESS;
+	}
+	printf("Cache misses per request\n");
+	__print_sweep_header("Batch");
+	for (int i = 0; i < NR_SWEEP_BATCH_SIZES; i++) {
+		printf("%-8d", sweep_batch_sizes[i]);
+		for (int j = 0; j < NR_SWEEP_NR_SLOTS; j++) {
+			printf(" %14.2f", misses[i][j]);
+		}
+		printf("\n");
+	}
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Name the ring buffer mode selected by the options
+ */
+static const char *__ringbuffer_mode(void)
+{
+	if (sharded_ringbuffer) return "sharded";
+	if (lockfree_ringbuffer) return "lockfree";
+	if (padded_ringbuffer) return adaptive_mutex ? "padded-adaptive" : "padded";
+	if (condvar_ringbuffer) return adaptive_mutex ? "condvar-adaptive" : "condvar";
+	return adaptive_mutex ? "mutex-adaptive" : "mutex";
+}
+
+/**
+ * Benchmark the ring buffer with 1, 2, 4, ... up to @nr_generators
+ * generators on @sweep_nr_slots and @sweep_batch_sizes, and write the
+ * results in @csv. The cache misses are left empty if not counted. The
+ * points the ring buffer does not support, such as fewer slots than the
+ * generators on the sharded ring buffer, are skipped.
+ */
+static int __bench_ringbuffer(FILE *csv)
+{
+	const int max_generators = nr_generators;
+	double samples[nr_bench_trials];
+	double misses[nr_bench_trials];
+
+	verbose = 0;
+
+	fprintf(csv, "mode,generators,counters,slots,batch,trials,"
+			"mean_req_per_sec,stddev_req_per_sec,mean_misses_per_req,"
+			"placement,layout\n");
+	for (nr_generators = 1; nr_generators <= max_generators; nr_generators <<= 1) {
+		for (int i = 0; i < NR_SWEEP_NR_SLOTS; i++) {
+			nr_slots = sweep_nr_slots[i];
+			if (sharded_ringbuffer && nr_slots < nr_generators) {
+				fprintf(stderr, "Skip %d generators on %d slots; the sharded "
+						"ring buffer needs a slot per generator\n",
+						nr_generators, nr_slots);
+				continue;
+			}
+
+			for (int j = 0; j < NR_SWEEP_BATCH_SIZES; j++) {
+				double mean, stddev, mean_misses, unused;
+				double warmup;
+
+				generator_batch = counter_batch = sweep_batch_sizes[j];
+
+				for (int k = -1; k < nr_bench_trials; k++) {
+					if (__run_ringbuffer(false, k < 0 ? &warmup : samples + k,
+								k < 0 ? &unused : misses + k)) {
+						fprintf(stderr, ">>> The ring buffer is **NOT** working properly "
+								"with %d generators, batch %d on %d slots!! <<<\n",
+								nr_generators, generator_batch, nr_slots);
+						return EXIT_FAILURE;
+					}
+				}
+				summarize_trials(samples, nr_bench_trials, &mean, &stddev);
+				summarize_trials(misses, nr_bench_trials, &mean_misses, &unused);
+
+				fprintf(csv, "%s,%d,%d,%d,%d,%d,%.1f,%.1f,", __ringbuffer_mode(),
+						nr_generators, nr_counters, nr_slots, generator_batch,
+						nr_bench_trials, mean, stddev);
+				if (mean_misses >= 0) fprintf(csv, "%.2f", mean_misses);
+				fprintf(csv, ",%s,", placement_name());
+				if (placement != placement_none) fprintf(csv, "%s", describe_placement());
+				fprintf(csv, "\n");
+				fflush(csv);
+			}
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Run the ring buffer in the open loop at 10%, 20%, ... up to 100% of
+ * @generator_rate, and write the achieved rate and the latencies from the
+ * scheduled times in @csv to chart the latency against the offered load
+ */
+#define NR_LOAD_STEPS	10
+
+static int __bench_load(FILE *csv)
+{
+	const double max_rate = generator_rate;
+	int retval = EXIT_SUCCESS;
+
+	verbose = 0;
+
+	fprintf(csv, "mode,generators,counters,slots,batch,offered_req_per_sec,"
+			"achieved_req_per_sec,requests,p50_usec,p99_usec,p999_usec,max_usec\n");
+	for (int step = 1; step <= NR_LOAD_STEPS; step++) {
+		struct latency_summary latency;
+		double performance, misses;
+
+		generator_rate = max_rate * step / NR_LOAD_STEPS;
+		if (__run_ringbuffer(false, &performance, &misses)) {
+			fprintf(stderr, ">>> The ring buffer is **NOT** working properly "
+					"at %.1f req/sec!! <<<\n", generator_rate);
+			retval = EXIT_FAILURE;
+			break;
+		}
+		summarize_latencies(latency_ringbuffer, &latency);
+
+		fprintf(csv, "%s,%d,%d,%d,%d,%.1f,%.1f,%lu,%.2f,%.2f,%.2f,%.2f\n",
+				__ringbuffer_mode(), nr_generators, nr_counters, nr_slots,
+				generator_batch, generator_rate, performance, latency.nr,
+				latency.p50 / 1e3, latency.p99 / 1e3, latency.p999 / 1e3,
+				latency.max / 1e3);
+		fflush(csv);
+	}
+	generator_rate = max_rate;
+	return retval;
+}
+
+static int __bench(void)
+{
+	FILE *csv = stdout;
+	int retval = EXIT_SUCCESS;
+
+	if (bench_output && !(csv = fopen(bench_output, "w"))) {
+		fprintf(stderr, "Cannot open %s\n", bench_output);
+		return EXIT_FAILURE;
+	}
+
+	if (strcmp(bench_target, "lock") == 0) {
+		retval = bench_locks(csv, bench_lock, nr_bench_trials);
+	} else if (strcmp(bench_target, "load") == 0) {
+		retval = __bench_load(csv);
+	} else {
+		retval = __bench_ringbuffer(csv);
+	}
+
+	if (csv != stdout) fclose(csv);
+	return retval;
+}
+
+int main(int argc, char * const argv[])
+{
+	int retval = EXIT_SUCCESS;
+	double performance, misses;
+
+	__print_message("\n");
+	__print_message(" _               _      _____         _            \n");
+	__print_message("| |    ___   ___| | __ |_   _|__  ___| |_ ___ _ __ \n");
+	__print_message("| |   / _ \\ / __| |/ /   | |/ _ \\/ __| __/ _ \\ '__|\n");
+	__print_message("| |__| (_) | (__|   <    | |  __/\\__ \\ ||  __/ |   \n");
+	__print_message("|_____\\___/ \\___|_|\\_\\   |_|\\___||___/\\__\\___|_|\n");
+	__print_message("\n");
+	__print_message("                                    2020 Spring\n");
+	__print_message("\n");
+
+	init_lock_stats();
+
+	if ((retval = parse_options(argc, argv))) {
+		return retval;
+	}
+	if (bench_target) {
+		return __bench();
+	}
+	if (sweep_batches) {
+		return __sweep_batches();
+	}
+	return __run_ringbuffer(true, &performance, &misses);
+}
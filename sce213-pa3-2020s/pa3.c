@@ -19,6 +19,8 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <errno.h>
+#include <string.h>
+#include <limits.h>
 
 #include <signal.h>
 #include <sys/types.h>
@@ -28,184 +30,1588 @@
 #include "locks.h"
 #include "atomic.h"
 #include "list_head.h"
+#include "parking.h"
+#include "histogram.h"
+#include "lockstat.h"
 
 /*********************************************************************
  * Spinlock implementation
  *********************************************************************/
 struct spinlock {
 	int  held;
+#ifdef CONFIG_LOCK_STAT
+	struct lock_stat *stat;
+#endif
+};
+
+/*********************************************************************
+ * init_spinlock(@lock)
+ *
+ * DESCRIPTION
+ *   Initialize your spinlock instance @lock
+ */
+void init_spinlock(struct spinlock *lock)
+{
+
+	lock->held = 0;
+#ifdef CONFIG_LOCK_STAT
+	lock->stat = register_lock_stat(lock, "spinlock");
+#endif
+	return;
+}
+
+/*********************************************************************
+ * acqure_spinlock(@lock)
+ *
+ * DESCRIPTION
+ *   Acquire the spinlock instance @lock. The returning from this
+ *   function implies that the calling thread grapped the lock.
+ *   In other words, you should not return from this function until
+ *   the calling thread gets the lock.
+ */
+void acquire_spinlock(struct spinlock *lock)
+{
+	unsigned long start = measure_latency ? latency_now() : 0;
+	unsigned long spins = 0;
+
+	if (compare_and_swap(&lock->held, 0, 1)) {
+		lock_stat_contended(lock_stat_of(lock));
+		while(compare_and_swap(&lock->held, 0, 1)) spins++;
+	}
+	lock_stat_acquired(lock_stat_of(lock), spins > 0, spins);
+
+	if (measure_latency) {
+		record_latency(latency_spinlock_acquire, latency_now() - start);
+	}
+	return;
+}
+
+/*********************************************************************
+ * release_spinlock(@lock)
+ *
+ * DESCRIPTION
+ *   Release the spinlock instance @lock. Keep in mind that the next thread
+ *   can grap the @lock instance right away when you mark @lock available;
+ *   any pending thread may grap @lock right after marking @lock as free
+ *   but before returning from this function.
+ */
+void release_spinlock(struct spinlock *lock)
+{
+	lock_stat_released(lock_stat_of(lock));
+	lock->held = 0;
+	return;
+}
+
+
+/*********************************************************************
+ * Ticket spinlock implementation
+ *
+ * A thread takes a ticket from @next with fetch_and_add(), and waits until
+ * @owner reaches the ticket. The waiters only read @owner while spinning,
+ * so the cache line is not bounced by locked instructions, and the lock is
+ * granted in the FIFO order. A waiter backs off in proportion to the number
+ * of threads ahead of it since it cannot get the lock before they do.
+ * The tickets are unsigned so that they wrap around safely; the distance
+ * from @owner to a ticket stays correct across the wraparound.
+ *********************************************************************/
+#define TICKET_BACKOFF		64	/* Pauses per waiter ahead */
+#define TICKET_MAX_BACKOFF	4096
+
+struct ticketlock {
+	unsigned int next;
+	unsigned int owner;
+};
+
+void init_ticketlock(struct ticketlock *lock)
+{
+	lock->next = 0;
+	lock->owner = 0;
+}
+
+void acquire_ticketlock(struct ticketlock *lock)
+{
+	unsigned int ticket = fetch_and_add_unsigned(&lock->next, 1);
+	unsigned int distance;
+
+	while ((distance = ticket - READ_ONCE(lock->owner)) != 0) {
+		unsigned int backoff = TICKET_MAX_BACKOFF;
+
+		if (distance < TICKET_MAX_BACKOFF / TICKET_BACKOFF) {
+			backoff = distance * TICKET_BACKOFF;
+		}
+		for (unsigned int i = 0; i < backoff; i++) {
+			cpu_relax();
+		}
+	}
+	barrier();
+}
+
+void release_ticketlock(struct ticketlock *lock)
+{
+	barrier();
+	WRITE_ONCE(lock->owner, lock->owner + 1);
+}
+
+
+/*********************************************************************
+ * Test-and-test-and-set spinlock implementation
+ *
+ * Spin on reading @held, which is served from the local cache, and try
+ * compare_and_swap() only when the lock looks free.
+ *********************************************************************/
+struct ttaslock {
+	int held;
+};
+
+void init_ttaslock(struct ttaslock *lock)
+{
+	lock->held = 0;
+}
+
+void acquire_ttaslock(struct ttaslock *lock)
+{
+	while (true) {
+		while (READ_ONCE(lock->held)) {
+			cpu_relax();
+		}
+		if (compare_and_swap(&lock->held, 0, 1) == 0) break;
+	}
+}
+
+void release_ttaslock(struct ttaslock *lock)
+{
+	barrier();
+	WRITE_ONCE(lock->held, 0);
+}
+
+
+/*********************************************************************
+ * Queue spinlocks
+ *
+ * The waiters form a queue of nodes and each spins on its own node, so
+ * a release touches only the cache line of the next waiter. The lock API
+ * takes no node, so each thread keeps a few nodes of its own to hold that
+ * many queue locks at the same time.
+ *
+ * The nodes are leaked on purpose. A CLH lock hands the nodes over from
+ * a thread to another, so a node cannot be told to belong to a thread or
+ * to a lock when either goes away, and the locks have no fini to free
+ * them. The leak is bounded by MAX_QNODES nodes for each thread that has
+ * taken a queue lock, plus one node for each CLH lock initialized.
+ *********************************************************************/
+#define MAX_QNODES	8	/* Queue locks a thread can hold at the same time */
+
+struct qnode {
+	struct qnode *next;
+	int locked;
+	bool in_use;
+} __attribute__((aligned(64)));
+
+static __thread struct qnode *__qnodes[MAX_QNODES] = { NULL };
+
+static struct qnode *__alloc_qnode(void)
+{
+	void *node;
+
+	if (posix_memalign(&node, sizeof(struct qnode), sizeof(struct qnode))) {
+		fprintf(stderr, "Cannot allocate a queue lock node\n");
+		abort();
+	}
+	return node;
+}
+
+static struct qnode *__get_qnode(void)
+{
+	for (int i = 0; i < MAX_QNODES; i++) {
+		if (!__qnodes[i]) {
+			__qnodes[i] = __alloc_qnode();
+			__qnodes[i]->in_use = false;
+		}
+		if (!__qnodes[i]->in_use) {
+			__qnodes[i]->in_use = true;
+			return __qnodes[i];
+		}
+	}
+	assert(0 && "Too many queue locks are held");
+	return NULL;
+}
+
+/**
+ * Give @node back to the thread, taking it over for @old in the CLH lock
+ */
+static void __put_qnode(struct qnode *old, struct qnode *node)
+{
+	for (int i = 0; i < MAX_QNODES; i++) {
+		if (__qnodes[i] == old) {
+			__qnodes[i] = node;
+			node->in_use = false;
+			return;
+		}
+	}
+	assert(0 && "Putting a qnode not owned");
+}
+
+
+/*********************************************************************
+ * MCS lock implementation
+ *
+ * A thread appends its node to @tail and spins on its own @locked until
+ * the predecessor hands over the lock by clearing it.
+ *********************************************************************/
+struct mcslock {
+	struct qnode *tail;
+	struct qnode *holder;	/* Node of the lock holder */
+};
+
+void init_mcslock(struct mcslock *lock)
+{
+	lock->tail = NULL;
+	lock->holder = NULL;
+}
+
+void acquire_mcslock(struct mcslock *lock)
+{
+	struct qnode *node = __get_qnode();
+	struct qnode *prev;
+
+	node->next = NULL;
+	node->locked = 1;
+
+	prev = exchange_pointer((void **)&lock->tail, node);
+	if (prev) {
+		WRITE_ONCE(prev->next, node);
+		while (READ_ONCE(node->locked)) {
+			cpu_relax();
+		}
+	}
+	lock->holder = node;
+	barrier();
+}
+
+void release_mcslock(struct mcslock *lock)
+{
+	struct qnode *node = lock->holder;
+	struct qnode *next;
+
+	barrier();
+	if (!READ_ONCE(node->next)) {
+		/* No one is waiting. Empty the queue */
+		if (compare_and_swap_pointer((void **)&lock->tail, node, NULL) == node) {
+			__put_qnode(node, node);
+			return;
+		}
+		/* A new waiter is linking itself to us */
+		while (!READ_ONCE(node->next)) {
+			cpu_relax();
+		}
+	}
+	next = node->next;
+	__put_qnode(node, node);
+	WRITE_ONCE(next->locked, 0);
+}
+
+
+/*********************************************************************
+ * CLH lock implementation
+ *
+ * A thread swaps its node into @tail and spins on the @locked of the
+ * predecessor's node. On release, it clears its own node for the successor
+ * and takes over the predecessor's node, which no one watches anymore.
+ *********************************************************************/
+struct clhlock {
+	struct qnode *tail;
+	struct qnode *holder;	/* Node of the lock holder */
+	struct qnode *prev;		/* Node the holder waited on */
+};
+
+void init_clhlock(struct clhlock *lock)
+{
+	lock->tail = __alloc_qnode();
+	lock->tail->locked = 0;
+	lock->holder = lock->prev = NULL;
+}
+
+void acquire_clhlock(struct clhlock *lock)
+{
+	struct qnode *node = __get_qnode();
+	struct qnode *prev;
+
+	node->locked = 1;
+
+	prev = exchange_pointer((void **)&lock->tail, node);
+	while (READ_ONCE(prev->locked)) {
+		cpu_relax();
+	}
+	lock->holder = node;
+	lock->prev = prev;
+	barrier();
+}
+
+void release_clhlock(struct clhlock *lock)
+{
+	struct qnode *node = lock->holder;
+	struct qnode *prev = lock->prev;
+
+	barrier();
+	__put_qnode(node, prev);
+	WRITE_ONCE(node->locked, 0);
+}
+
+
+/*********************************************************************
+ * Cohort lock implementation
+ *
+ * A NUMA-aware lock built of a global ticket lock and a ticket lock per
+ * node. A thread takes the lock of its node first, and then the global
+ * lock unless its node holds it already. On release, the holder passes
+ * the global lock to the next waiter of the same node along with the
+ * node lock, keeping the lock and the data it protects in the node,
+ * until COHORT_MAX_PASSES passes in a row; then it releases the global
+ * lock for the other nodes not to starve.
+ *
+ * The node of a thread is read with getcpu(2) when the thread takes a
+ * cohort lock first; the threads are expected to stay on their nodes.
+ *********************************************************************/
+#define COHORT_MAX_NODES	8
+#define COHORT_MAX_PASSES	64	/* Local handoffs before releasing the global lock */
+
+struct cohort_node {
+	struct ticketlock lock;
+	bool global_held;			/* The node holds the global lock */
+	int nr_passes;				/* Local handoffs in a row */
+} __attribute__((aligned(64)));
+
+struct cohortlock {
+	struct ticketlock global;
+	int holder_node;			/* Node of the holder, or of the last one */
+	unsigned long nr_local_handoffs;
+	unsigned long nr_remote_handoffs;
+	struct cohort_node nodes[COHORT_MAX_NODES];
+} __attribute__((aligned(64)));
+
+static __thread int __numa_node = -1;
+
+static int __get_numa_node(void)
+{
+	if (__numa_node < 0) {
+		unsigned cpu, node;
+
+		if (syscall(SYS_getcpu, &cpu, &node, NULL)) node = 0;
+		__numa_node = node % COHORT_MAX_NODES;
+	}
+	return __numa_node;
+}
+
+void init_cohortlock(struct cohortlock *lock)
+{
+	init_ticketlock(&lock->global);
+	lock->holder_node = -1;
+	lock->nr_local_handoffs = lock->nr_remote_handoffs = 0;
+
+	for (int i = 0; i < COHORT_MAX_NODES; i++) {
+		init_ticketlock(&lock->nodes[i].lock);
+		lock->nodes[i].global_held = false;
+		lock->nodes[i].nr_passes = 0;
+	}
+}
+
+void acquire_cohortlock(struct cohortlock *lock)
+{
+	int node = __get_numa_node();
+	struct cohort_node *cohort = lock->nodes + node;
+
+	acquire_ticketlock(&cohort->lock);
+	if (!cohort->global_held) {
+		acquire_ticketlock(&lock->global);
+		cohort->global_held = true;
+		cohort->nr_passes = 0;
+	}
+
+	/* Counted with the lock held */
+	if (lock->holder_node == node) {
+		lock->nr_local_handoffs++;
+	} else if (lock->holder_node >= 0) {
+		lock->nr_remote_handoffs++;
+	}
+	lock->holder_node = node;
+}
+
+void release_cohortlock(struct cohortlock *lock)
+{
+	struct cohort_node *cohort = lock->nodes + lock->holder_node;
+	unsigned int nr_queued = READ_ONCE(cohort->lock.next) - cohort->lock.owner;
+	bool waiting = nr_queued > 1;
+
+	if (waiting && cohort->nr_passes < COHORT_MAX_PASSES) {
+		/* Pass the global lock to the next one of the node */
+		cohort->nr_passes++;
+	} else {
+		cohort->global_held = false;
+		release_ticketlock(&lock->global);
+	}
+	release_ticketlock(&cohort->lock);
+}
+
+void get_cohortlock_handoffs(struct cohortlock *lock,
+		unsigned long *nr_local, unsigned long *nr_remote)
+{
+	*nr_local = lock->nr_local_handoffs;
+	*nr_remote = lock->nr_remote_handoffs;
+}
+
+
+/********************************************************************
+ * Blocking mutex implementation
+ *
+ * The mutex keeps no waitqueue of its own; the waiters park on the
+ * address of the mutex in the parking lot. @key is the number of the keys
+ * left, or the negative number of the parked waiters. It is updated with
+ * atomic instructions on the fast paths, which touch it only when no one
+ * is parked, and under the lock of the wait queue otherwise.
+ ********************************************************************/
+struct mutex {
+	int key;
+	bool adaptive;				/* Spin for a while before parking */
+	struct wait_record *owner;	/* Thread that took the key last */
+#ifdef CONFIG_LOCK_STAT
+	struct lock_stat *stat;
+#endif
+};
+
+#define MUTEX_SPIN_BUDGET	4096	/* Pauses to spin before parking */
+#define MUTEX_MAX_BACKOFF	256
+
+bool adaptive_mutex = false;
+int mutex_spin_budget = MUTEX_SPIN_BUDGET;
+
+
+/*********************************************************************
+ * init_mutex(@mutex)
+ *
+ * DESCRIPTION
+ *   Initialize the mutex instance pointed by @mutex.
+ */
+
+
+
+void init_mutex(struct mutex *mutex)
+{	
+	mutex->key = 1;
+	mutex->adaptive = false;
+	mutex->owner = NULL;
+#ifdef CONFIG_LOCK_STAT
+	mutex->stat = register_lock_stat(mutex, "mutex");
+#endif
+	return;
+}
+
+/*********************************************************************
+ * init_adaptive_mutex(@mutex)
+ *
+ * DESCRIPTION
+ *   Initialize @mutex as an adaptive mutex. An adaptive mutex spins with
+ *   a bounded backoff while the owner is running, expecting the owner to
+ *   release the key soon. It parks only after spinning for
+ *   @mutex_spin_budget pauses, when the owner is parked itself, or when
+ *   other waiters are parked already.
+ */
+void init_adaptive_mutex(struct mutex *mutex)
+{
+	init_mutex(mutex);
+	mutex->adaptive = true;
+#ifdef CONFIG_LOCK_STAT
+	mutex->stat = register_lock_stat(mutex, "adaptive");
+#endif
+}
+
+/**
+ * Take a key of @mutex if any is left. Return true if @self takes the key
+ */
+static bool __try_take_key(struct mutex *mutex, struct wait_record *self)
+{
+	int key;
+
+	while ((key = READ_ONCE(mutex->key)) > 0) {
+		if (compare_and_swap(&mutex->key, key, key - 1) == key) {
+			mutex->owner = self;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Take a key of @mutex without waiting. Return true if the key is taken
+ */
+static bool __try_acquire_mutex(struct mutex *mutex)
+{
+	if (!__try_take_key(mutex, current_wait_record())) return false;
+
+	lock_stat_acquired(lock_stat_of(mutex), false, 0);
+	return true;
+}
+
+/**
+ * Spin for the key of @mutex, counting the pauses in @spins. Return true
+ * if @self takes the key
+ */
+static bool __spin_mutex(struct mutex *mutex, struct wait_record *self,
+		unsigned long *spins)
+{
+	int backoff = 1;
+
+	for (*spins = 0; (long)*spins < mutex_spin_budget; *spins += backoff) {
+		int key = READ_ONCE(mutex->key);
+		struct wait_record *owner = READ_ONCE(mutex->owner);
+
+		if (key > 0) {
+			if (__try_take_key(mutex, self)) return true;
+		} else if (key < 0) {
+			/* The key will be handed over to the parked ones */
+			return false;
+		} else if (owner && READ_ONCE(owner->parked)) {
+			return false;
+		}
+
+		for (int i = 0; i < backoff; i++) {
+			cpu_relax();
+		}
+		if (backoff < MUTEX_MAX_BACKOFF) backoff <<= 1;
+	}
+	return false;
+}
+
+/**
+ * Called with the wait queue locked. Take a key or decide to park
+ */
+static bool __validate_park(void *arg)
+{
+	struct mutex *mutex = arg;
+
+	if (fetch_and_add(&mutex->key, -1) > 0) {
+		mutex->owner = current_wait_record();
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Called with the wait queue locked. Return the key, handing it over to
+ * @waiter if there is one
+ */
+static void __hand_over(void *arg, struct wait_record *waiter)
+{
+	struct mutex *mutex = arg;
+	int key = fetch_and_add(&mutex->key, 1);
+
+	assert((key < 0) == (waiter != NULL));
+	mutex->owner = waiter;
+}
+
+/*********************************************************************
+ * acquire_mutex(@mutex)
+ *
+ * DESCRIPTION
+ *   Acquire the mutex instance @mutex. Likewise acquire_spinlock(), you
+ *   should not return from this function until the calling thread gets the
+ *   mutex instance. But the calling thread should be put into sleep when
+ *   the mutex is acquired by other threads.
+ *
+ *   The calling thread parks on @mutex when no key is left, and the
+ *   releasing thread hands the key over to the thread parked first.
+ */
+
+static void __acquire_mutex(struct mutex *mutex)
+{
+	struct wait_record *self = current_wait_record();
+	struct lock_stat *stat = lock_stat_of(mutex);
+	unsigned long spins = 0;
+
+	if (__try_take_key(mutex, self)) {
+		lock_stat_acquired(stat, false, 0);
+		return;
+	}
+	lock_stat_contended(stat);
+
+	if (!mutex->adaptive || !__spin_mutex(mutex, self, &spins)) {
+		if (park(mutex, __validate_park, mutex)) lock_stat_parked(stat);
+	}
+	lock_stat_acquired(stat, true, spins);
+}
+
+void acquire_mutex(struct mutex *mutex)
+{	
+	unsigned long start;
+
+	if (!measure_latency) {
+		__acquire_mutex(mutex);
+		return;
+	}
+
+	start = latency_now();
+	__acquire_mutex(mutex);
+	record_latency(latency_mutex_acquire, latency_now() - start);
+	return;
+}
+
+void acquire_adaptive_mutex(struct mutex *mutex)
+{
+	acquire_mutex(mutex);
+}
+
+
+/*********************************************************************
+ * release_mutex(@mutex)
+ *
+ * DESCRIPTION
+ *   Release the mutex held by the calling thread.
+ */
+void release_mutex(struct mutex *mutex)
+{	
+	int key;
+
+	lock_stat_released(lock_stat_of(mutex));
+
+	while ((key = READ_ONCE(mutex->key)) >= 0) {
+		if (compare_and_swap(&mutex->key, key, key + 1) == key) return;
+	}
+	if (unpark_one(mutex, __hand_over, mutex)) {
+		lock_stat_unparked(lock_stat_of(mutex));
+	}
+	return;
+}	
+
+void release_adaptive_mutex(struct mutex *mutex)
+{
+	release_mutex(mutex);
+}
+
+
+
+/*********************************************************************
+ * Condition variable implementation
+ *
+ * Waiters park on the address of the condition variable after releasing
+ * the mutex, and park only if @sequence has not moved since then so that
+ * a signal in between is not lost. A signal does not wake up the waiter
+ * but moves it onto the wait queue of the mutex, which the signaling
+ * thread holds, as if the waiter has parked for the mutex. The waiter is
+ * woken up with the mutex handed over when the mutex is released, rather
+ * than woken up only to find the mutex held and park again.
+ *
+ * All the waiters of a condition variable should use the same mutex, and
+ * signal and broadcast should be called with the mutex held.
+ *********************************************************************/
+struct condvar {
+	int sequence;			/* Moved by every signal and broadcast */
+	int nr_waiters;			/* Parked or about to park */
+	struct mutex *mutex;	/* Mutex the waiters use */
+};
+
+void init_condvar(struct condvar *cond)
+{
+	cond->sequence = 0;
+	cond->nr_waiters = 0;
+	cond->mutex = NULL;
+}
+
+struct condvar_wait {
+	struct condvar *cond;
+	int sequence;
+};
+
+/**
+ * Called with the wait queue locked. Park unless signaled in the meantime
+ */
+static bool __validate_condvar(void *arg)
+{
+	struct condvar_wait *wait = arg;
+
+	if (READ_ONCE(wait->cond->sequence) != wait->sequence) {
+		fetch_and_add(&wait->cond->nr_waiters, -1);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Called with the wait queues of @cond and its mutex locked. The waiter
+ * now waits for the mutex as the parked ones do
+ */
+static void __morph_waiter(void *arg, struct wait_record *waiter)
+{
+	struct condvar *cond = arg;
+	(void)waiter;
+
+	fetch_and_add(&cond->nr_waiters, -1);
+	fetch_and_add(&cond->mutex->key, -1);
+}
+
+void wait_condvar(struct condvar *cond, struct mutex *mutex)
+{
+	struct condvar_wait wait = {
+		.cond = cond,
+	};
+
+	cond->mutex = mutex;
+	fetch_and_add(&cond->nr_waiters, 1);
+	wait.sequence = READ_ONCE(cond->sequence);
+	release_mutex(mutex);
+
+	if (park(cond, __validate_condvar, &wait) &&
+			current_wait_record()->address == mutex) {
+		/* Moved onto the mutex, and the mutex is handed over */
+		lock_stat_acquired(lock_stat_of(mutex), false, 0);
+		return;
+	}
+	acquire_mutex(mutex);
+}
+
+/**
+ * Move up to @nr waiters of @cond onto its mutex. Return the number moved
+ */
+static int __wake_condvar(struct condvar *cond, int nr)
+{
+	if (!READ_ONCE(cond->nr_waiters)) return 0;
+
+	fetch_and_add(&cond->sequence, 1);
+	return requeue(cond, cond->mutex, nr, __morph_waiter, cond);
+}
+
+void signal_condvar(struct condvar *cond)
+{
+	__wake_condvar(cond, 1);
+}
+
+void broadcast_condvar(struct condvar *cond)
+{
+	__wake_condvar(cond, INT_MAX);
+}
+
+
+/*********************************************************************
+ * Reader-writer spinlock implementation
+ *
+ * @state is the number of the readers holding the lock, or -1 while a
+ * writer holds it. A writer counts itself in @nr_writers before waiting
+ * for the readers to leave, and new readers wait while any writer is
+ * counted there, so that a stream of readers cannot starve the writers.
+ * Readers may starve instead under a stream of writers.
+ *********************************************************************/
+struct rwlock {
+	int state;
+	int nr_writers;		/* Writers waiting or holding the lock */
+};
+
+void init_rwlock(struct rwlock *lock)
+{
+	lock->state = 0;
+	lock->nr_writers = 0;
+}
+
+void acquire_rwlock_read(struct rwlock *lock)
+{
+	while (true) {
+		int state;
+
+		while (READ_ONCE(lock->nr_writers)) {
+			cpu_relax();
+		}
+		state = READ_ONCE(lock->state);
+		if (state >= 0 && compare_and_swap(&lock->state, state, state + 1) == state) break;
+		cpu_relax();
+	}
+}
+
+void release_rwlock_read(struct rwlock *lock)
+{
+	fetch_and_add(&lock->state, -1);
+}
+
+void acquire_rwlock_write(struct rwlock *lock)
+{
+	fetch_and_add(&lock->nr_writers, 1);
+	while (true) {
+		while (READ_ONCE(lock->state)) {
+			cpu_relax();
+		}
+		if (compare_and_swap(&lock->state, 0, -1) == 0) break;
+	}
+}
+
+void release_rwlock_write(struct rwlock *lock)
+{
+	barrier();
+	WRITE_ONCE(lock->state, 0);
+	fetch_and_add(&lock->nr_writers, -1);
+}
+
+
+/*********************************************************************
+ * Reader-writer semaphore implementation
+ *
+ * The blocking counterpart of the reader-writer spinlock with the same
+ * @state and @nr_writers. Readers park on @nr_writers and writers park on
+ * @state in the parking lot. The last reader leaving wakes up a writer,
+ * and a leaving writer wakes up the next writer if any is counted, or all
+ * the parked readers otherwise.
+ *********************************************************************/
+struct rwsem {
+	int state;
+	int nr_writers;
+};
+
+void init_rwsem(struct rwsem *sem)
+{
+	sem->state = 0;
+	sem->nr_writers = 0;
+}
+
+/**
+ * Called with the wait queue locked. Park while any writer is counted
+ */
+static bool __validate_rwsem_reader(void *arg)
+{
+	struct rwsem *sem = arg;
+
+	return READ_ONCE(sem->nr_writers) > 0;
+}
+
+/**
+ * Called with the wait queue locked. Park while the lock is held
+ */
+static bool __validate_rwsem_writer(void *arg)
+{
+	struct rwsem *sem = arg;
+
+	return READ_ONCE(sem->state) != 0;
+}
+
+void acquire_rwsem_read(struct rwsem *sem)
+{
+	while (true) {
+		int state;
+
+		if (READ_ONCE(sem->nr_writers)) {
+			park(&sem->nr_writers, __validate_rwsem_reader, sem);
+			continue;
+		}
+		state = READ_ONCE(sem->state);
+		if (state >= 0 && compare_and_swap(&sem->state, state, state + 1) == state) break;
+	}
+}
+
+void release_rwsem_read(struct rwsem *sem)
+{
+	if (fetch_and_add(&sem->state, -1) == 1 && READ_ONCE(sem->nr_writers)) {
+		unpark_one(&sem->state, NULL, NULL);
+	}
+}
+
+void acquire_rwsem_write(struct rwsem *sem)
+{
+	fetch_and_add(&sem->nr_writers, 1);
+	while (compare_and_swap(&sem->state, 0, -1) != 0) {
+		park(&sem->state, __validate_rwsem_writer, sem);
+	}
+}
+
+void release_rwsem_write(struct rwsem *sem)
+{
+	barrier();
+	WRITE_ONCE(sem->state, 0);
+	if (fetch_and_add(&sem->nr_writers, -1) > 1) {
+		unpark_one(&sem->state, NULL, NULL);
+	} else {
+		unpark_all(&sem->nr_writers);
+	}
+}
+
+
+/*********************************************************************
+ * Seqlock implementation
+ *
+ * Writers serialize on @lock and make @sequence odd while updating the
+ * data. Readers take no lock; they read the data optimistically and retry
+ * if @sequence was odd or has moved in the meantime. Fits small data read
+ * far more often than written, and the readers should not follow pointers
+ * in the data which may be freed under them.
+ *********************************************************************/
+struct seqlock {
+	unsigned int sequence;
+	struct ttaslock lock;
+};
+
+void init_seqlock(struct seqlock *lock)
+{
+	lock->sequence = 0;
+	init_ttaslock(&lock->lock);
+}
+
+unsigned int read_seqbegin(struct seqlock *lock)
+{
+	unsigned int sequence;
+
+	while ((sequence = READ_ONCE(lock->sequence)) & 1) {
+		cpu_relax();
+	}
+	barrier();
+	return sequence;
+}
+
+bool read_seqretry(struct seqlock *lock, unsigned int sequence)
+{
+	barrier();
+	return READ_ONCE(lock->sequence) != sequence;
+}
+
+void write_seqlock(struct seqlock *lock)
+{
+	acquire_ttaslock(&lock->lock);
+	WRITE_ONCE(lock->sequence, lock->sequence + 1);
+	barrier();
+}
+
+void write_sequnlock(struct seqlock *lock)
+{
+	barrier();
+	WRITE_ONCE(lock->sequence, lock->sequence + 1);
+	release_ttaslock(&lock->lock);
+}
+
+
+
+/*********************************************************************
+ * Ring buffer
+ *********************************************************************/
+
+/**
+ * The adjacent-line prefetcher pulls in cache lines in pairs, so a line
+ * written by one side is kept two lines away from the other side's.
+ */
+#define RING_LINE_SIZE	128
+
+/**
+ * Producers or consumers of the padded mode
+ */
+struct ring_side {
+	struct mutex lock;		/* Serializes the threads on this side */
+	long index;				/* Next position to fill or to take */
+	long cached;			/* Last seen index of the other side */
+} __attribute__((aligned(RING_LINE_SIZE)));
+
+/**
+ * Index published by a side of the padded mode
+ */
+struct ring_index {
+	long published;
+	int nr_parked;			/* Threads waiting for @published to move */
+} __attribute__((aligned(RING_LINE_SIZE)));
+
+struct ringbuffer {
+	/** NEVER CHANGE @nr_slots AND @slots ****/
+	/**/ int nr_slots;                     /**/
+	/**/ int *slots;                       /**/
+	/*****************************************/
+
+	struct mutex mutex;
+	struct mutex empty;
+	struct mutex full;
+
+	int in, out;
+
+	/* For the lock-free mode */
+	bool lockfree;
+	long *seqs;					/* Position each slot is ready for */
+	long head;					/* Next position to dequeue */
+	long tail;					/* Next position to enqueue */
+	bool single_consumer;		/* Only one consumer moves @head */
+	int nr_parked_producers;
+	int nr_parked_consumers;
+
+	/* For the sharded mode */
+	bool sharded;
+	struct shard *shards;
+	int nr_shards;
+	int nr_shards_taken;		/* Shards given to producers so far */
+	int next_shard;				/* Shard to poll first */
+	int consumer_parked;
+
+	/* For the padded mode */
+	bool padded;
+	struct ring_side producer;
+	struct ring_side consumer;
+	struct ring_index filled;	/* Published by the producers */
+	struct ring_index emptied;	/* Published by the consumers */
+
+	/* For the condition variable mode */
+	bool condvar;
+	struct condvar not_empty;
+	struct condvar not_full;
+	int nr_filled;
+
+	/* Time each value is enqueued at, alongside @slots while measuring */
+	unsigned long *stamps;
+};
+
+bool lockfree_ringbuffer = false;
+bool sharded_ringbuffer = false;
+bool padded_ringbuffer = false;
+bool condvar_ringbuffer = false;
+
+struct ringbuffer ringbuffer = {
+	.in = 0,
+	.out = 0,
+};
+
+/* Time the calling thread has started, or meant to start, to enqueue at */
+static __thread unsigned long __enqueued_at;
+
+/**
+ * Stamp @nr slots of @slots from @index with the enqueue time. The stamps
+ * are kept in @ringbuffer.stamps at the same offsets as the slots, which
+ * may be a part of @ringbuffer.slots as a shard is
+ */
+static void __stamp_slots(int *slots, int nr_slots, int index, int nr)
+{
+	unsigned long *stamps = ringbuffer.stamps + (slots - ringbuffer.slots);
+
+	for (int i = 0; i < nr; i++) {
+		stamps[(index + i) % nr_slots] = __enqueued_at;
+	}
+}
+
+/**
+ * Record the time from the enqueue to now for @nr slots of @slots from @index
+ */
+static void __record_slots(int *slots, int nr_slots, int index, int nr)
+{
+	unsigned long *stamps = ringbuffer.stamps + (slots - ringbuffer.slots);
+	unsigned long now = latency_now();
+
+	for (int i = 0; i < nr; i++) {
+		record_latency(latency_ringbuffer, now - stamps[(index + i) % nr_slots]);
+	}
+}
+
+/**
+ * Copy @nr values into @slots of @nr_slots from @index, wrapping around
+ * at the end
+ */
+static void __copy_into_slots(int *slots, int nr_slots, int index, const int values[], int nr)
+{
+	int nr_first = nr_slots - index;
+
+	if (nr_first > nr) nr_first = nr;
+	memcpy(slots + index, values, sizeof(int) * nr_first);
+	memcpy(slots, values + nr_first, sizeof(int) * (nr - nr_first));
+
+	if (ringbuffer.stamps) __stamp_slots(slots, nr_slots, index, nr);
+}
+
+static void __copy_from_slots(int *slots, int nr_slots, int index, int values[], int nr)
+{
+	int nr_first = nr_slots - index;
+
+	if (nr_first > nr) nr_first = nr;
+	memcpy(values, slots + index, sizeof(int) * nr_first);
+	memcpy(values + nr_first, slots, sizeof(int) * (nr - nr_first));
+
+	if (ringbuffer.stamps) __record_slots(slots, nr_slots, index, nr);
+}
 
-};
 
 /*********************************************************************
- * init_spinlock(@lock)
+ * Lock-free ring buffer
  *
- * DESCRIPTION
- *   Initialize your spinlock instance @lock
+ * Each slot has a sequence number telling the position the slot is ready
+ * for; @seqs[i] == pos means that the slot is empty and can be filled for
+ * position @pos, and @seqs[i] == pos + 1 means that the slot is filled for
+ * @pos. Producers claim a run of empty slots from @tail and consumers claim
+ * a run of filled slots from @head, both with compare-and-swap. A single
+ * consumer owns @head, so it just stores the new @head without the retry
+ * loop and stays wait-free. The claimer fills or empties the slots and
+ * advances their sequence numbers.
+ *
+ * Producers park on @tail when the buffer is full and consumers park on
+ * @head when the buffer is empty. Each side checks the number of the parked
+ * threads on the other side after updating the sequence numbers, and a
+ * parking thread checks the sequence number after counting itself, so that
+ * either of them sees the update of the other. The mutexes are not used.
+ *********************************************************************/
+static bool __validate_producer(void *arg)
+{
+	long pos = (long)arg;
+
+	fetch_and_add(&ringbuffer.nr_parked_producers, 1);
+	if (READ_ONCE(ringbuffer.seqs[pos % ringbuffer.nr_slots]) >= pos) {
+		fetch_and_add(&ringbuffer.nr_parked_producers, -1);
+		return false;
+	}
+	return true;
+}
+
+static void __unparked_producer(void *arg, struct wait_record *waiter)
+{
+	(void)arg;
+	if (waiter) fetch_and_add(&ringbuffer.nr_parked_producers, -1);
+}
+
+static bool __validate_consumer(void *arg)
+{
+	long pos = (long)arg;
+
+	fetch_and_add(&ringbuffer.nr_parked_consumers, 1);
+	if (READ_ONCE(ringbuffer.seqs[pos % ringbuffer.nr_slots]) >= pos + 1) {
+		fetch_and_add(&ringbuffer.nr_parked_consumers, -1);
+		return false;
+	}
+	return true;
+}
+
+static void __unparked_consumer(void *arg, struct wait_record *waiter)
+{
+	(void)arg;
+	if (waiter) fetch_and_add(&ringbuffer.nr_parked_consumers, -1);
+}
+
+/**
+ * Count the slots from @pos, up to @max, whose sequence numbers are
+ * @offset ahead of their positions
  */
-void init_spinlock(struct spinlock *lock)
+static int __nr_ready_slots(long pos, int max, long offset)
 {
+	int nr = 0;
 
-	lock->held = 0;
-	return;
+	while (nr < max &&
+			READ_ONCE(ringbuffer.seqs[(pos + nr) % ringbuffer.nr_slots]) == pos + nr + offset) {
+		nr++;
+	}
+	return nr;
 }
 
-/*********************************************************************
- * acqure_spinlock(@lock)
- *
- * DESCRIPTION
- *   Acquire the spinlock instance @lock. The returning from this
- *   function implies that the calling thread grapped the lock.
- *   In other words, you should not return from this function until
- *   the calling thread gets the lock.
+/**
+ * Wake up to @nr threads parked on @address while any is counted in
+ * @nr_parked. @callback is called with @nr_parked
  */
-void acquire_spinlock(struct spinlock *lock)
+static void __unpark_many(void *address, int *nr_parked, int nr,
+		void (*callback)(void *, struct wait_record *))
 {
-	while(compare_and_swap(&lock->held, 0, 1));
-	return;
+	smp_mb();
+	for (int i = 0; i < nr && READ_ONCE(*nr_parked); i++) {
+		if (!unpark_one(address, callback, nr_parked)) break;
+	}
 }
 
-/*********************************************************************
- * release_spinlock(@lock)
- *
- * DESCRIPTION
- *   Release the spinlock instance @lock. Keep in mind that the next thread
- *   can grap the @lock instance right away when you mark @lock available;
- *   any pending thread may grap @lock right after marking @lock as free
- *   but before returning from this function.
+/**
+ * Reserve up to @max empty slots at the tail, fill them with @values, and
+ * publish them all at once. Return the number of the values enqueued
  */
-void release_spinlock(struct spinlock *lock)
+static int __enqueue_many_lockfree(const int values[], int max)
 {
-	lock->held = 0;
-	return;
+	long pos;
+	int nr;
+
+	for (;;) {
+		pos = READ_ONCE(ringbuffer.tail);
+		nr = __nr_ready_slots(pos, max, 0);
+
+		if (nr == 0) {
+			if (READ_ONCE(ringbuffer.seqs[pos % ringbuffer.nr_slots]) < pos) {
+				/* Not emptied since the last round. The buffer is full */
+				park(&ringbuffer.tail, __validate_producer, (void *)pos);
+			}
+			continue;
+		}
+		if (compare_and_swap_long(&ringbuffer.tail, pos, pos + nr) == pos) break;
+	}
+
+	__copy_into_slots(ringbuffer.slots, ringbuffer.nr_slots,
+			pos % ringbuffer.nr_slots, values, nr);
+	barrier();
+	for (int i = 0; i < nr; i++) {
+		WRITE_ONCE(ringbuffer.seqs[(pos + i) % ringbuffer.nr_slots], pos + i + 1);
+	}
+
+	__unpark_many(&ringbuffer.head, &ringbuffer.nr_parked_consumers, nr,
+			__unparked_consumer);
+	return nr;
 }
 
+/**
+ * Take up to @max values published at the head, waiting for one if none
+ * is. Return the number of the values dequeued
+ */
+static int __dequeue_many_lockfree(int values[], int max)
+{
+	long pos;
+	int nr;
 
-/********************************************************************
- * Blocking mutex implementation
- ********************************************************************/
-struct thread {
-	pthread_t pthread;
-	struct list_head list;
-};
+	for (;;) {
+		pos = READ_ONCE(ringbuffer.head);
+		nr = __nr_ready_slots(pos, max, 1);
 
+		if (nr == 0) {
+			if (READ_ONCE(ringbuffer.seqs[pos % ringbuffer.nr_slots]) < pos + 1) {
+				/* Not filled yet. The buffer is empty */
+				park(&ringbuffer.head, __validate_consumer, (void *)pos);
+			}
+			continue;
+		}
+		if (ringbuffer.single_consumer) {
+			WRITE_ONCE(ringbuffer.head, pos + nr);
+			break;
+		}
+		if (compare_and_swap_long(&ringbuffer.head, pos, pos + nr) == pos) break;
+	}
 
-struct mutex {
-	int key;
-	struct spinlock spinlock;
-	struct list_head waitqueue;
-};
+	barrier();
+	__copy_from_slots(ringbuffer.slots, ringbuffer.nr_slots,
+			pos % ringbuffer.nr_slots, values, nr);
+	barrier();
+	for (int i = 0; i < nr; i++) {
+		WRITE_ONCE(ringbuffer.seqs[(pos + i) % ringbuffer.nr_slots],
+				pos + i + ringbuffer.nr_slots);
+	}
 
+	__unpark_many(&ringbuffer.tail, &ringbuffer.nr_parked_producers, nr,
+			__unparked_producer);
+	return nr;
+}
 
 
 /*********************************************************************
- * init_mutex(@mutex)
+ * Sharded ring buffer
  *
- * DESCRIPTION
- *   Initialize the mutex instance pointed by @mutex.
- */
+ * Each producer owns a shard, a single-producer single-consumer ring
+ * carved out of @slots, so that the producers never contend with each
+ * other. Only the producer moves the @tail of its shard and only the
+ * consumer moves the @head, each on its own cache line, and no atomic
+ * instruction is needed. The consumer polls the shards in round robin,
+ * draining a batch from a shard at a time, and parks only when all the
+ * shards are empty. A producer parks on its shard when the shard is full.
+ * Supports a single consumer.
+ *********************************************************************/
+struct shard {
+	int first;				/* Index of the first slot in @slots */
+	int size;
+	long tail;				/* Next position to fill */
+	int producer_parked;
+	long head __attribute__((aligned(64)));	/* Next position to take */
+} __attribute__((aligned(64)));
 
+static __thread struct shard *__shard = NULL;
 
+static struct shard *__get_shard(void)
+{
+	if (!__shard) {
+		int shard = fetch_and_add(&ringbuffer.nr_shards_taken, 1);
+		assert(shard < ringbuffer.nr_shards && "More producers than shards");
+		__shard = ringbuffer.shards + shard;
+	}
+	return __shard;
+}
 
-void init_mutex(struct mutex *mutex)
-{	
-	mutex->key = 1;
-	init_spinlock(&mutex->spinlock);
-	INIT_LIST_HEAD(&mutex->waitqueue);
-	return;
+static bool __validate_shard_producer(void *arg)
+{
+	struct shard *shard = arg;
+
+	WRITE_ONCE(shard->producer_parked, 1);
+	smp_mb();
+	if (shard->tail - READ_ONCE(shard->head) < shard->size) {
+		WRITE_ONCE(shard->producer_parked, 0);
+		return false;
+	}
+	return true;
+}
+
+static bool __validate_shard_consumer(void *arg)
+{
+	(void)arg;
+	WRITE_ONCE(ringbuffer.consumer_parked, 1);
+	smp_mb();
+	for (int i = 0; i < ringbuffer.nr_shards; i++) {
+		struct shard *shard = ringbuffer.shards + i;
+		if (READ_ONCE(shard->tail) != shard->head) {
+			WRITE_ONCE(ringbuffer.consumer_parked, 0);
+			return false;
+		}
+	}
+	return true;
+}
+
+static int __enqueue_many_sharded(const int values[], int max)
+{
+	struct shard *shard = __get_shard();
+	long tail = shard->tail;
+	long nr;
+
+	while ((nr = shard->size - (tail - READ_ONCE(shard->head))) == 0) {
+		park(shard, __validate_shard_producer, shard);
+	}
+	if (nr > max) nr = max;
+
+	__copy_into_slots(ringbuffer.slots + shard->first, shard->size,
+			tail % shard->size, values, nr);
+	barrier();
+	WRITE_ONCE(shard->tail, tail + nr);
+
+	/* Only the one clearing the flag unparks the consumer */
+	smp_mb();
+	if (READ_ONCE(ringbuffer.consumer_parked) &&
+			compare_and_swap(&ringbuffer.consumer_parked, 1, 0) == 1) {
+		unpark_one(&ringbuffer.shards, NULL, NULL);
+	}
+	return nr;
+}
+
+static int __dequeue_many_sharded(int values[], int max)
+{
+	for (;;) {
+		for (int i = 0; i < ringbuffer.nr_shards; i++) {
+			int index = (ringbuffer.next_shard + i) % ringbuffer.nr_shards;
+			struct shard *shard = ringbuffer.shards + index;
+			long head = shard->head;
+			long nr = READ_ONCE(shard->tail) - head;
+
+			if (!nr) continue;
+			if (nr > max) nr = max;
+
+			barrier();
+			__copy_from_slots(ringbuffer.slots + shard->first, shard->size,
+					head % shard->size, values, nr);
+			barrier();
+			WRITE_ONCE(shard->head, head + nr);
+
+			smp_mb();
+			if (READ_ONCE(shard->producer_parked) &&
+					compare_and_swap(&shard->producer_parked, 1, 0) == 1) {
+				unpark_one(shard, NULL, NULL);
+			}
+			ringbuffer.next_shard = (index + 1) % ringbuffer.nr_shards;
+			return nr;
+		}
+		park(&ringbuffer.shards, __validate_shard_consumer, NULL);
+	}
 }
 
+
 /*********************************************************************
- * acquire_mutex(@mutex)
+ * Padded ring buffer
  *
- * DESCRIPTION
- *   Acquire the mutex instance @mutex. Likewise acquire_spinlock(), you
- *   should not return from this function until the calling thread gets the
- *   mutex instance. But the calling thread should be put into sleep when
- *   the mutex is acquired by other threads.
+ * The producers and the consumers take their own mutex instead of sharing
+ * one, and each side moves its own index. The mutex and the private index
+ * of a side, the published index of the producers, and that of the
+ * consumers are on their own cache lines, so the two sides do not keep
+ * stealing the lines from each other.
  *
- * HINT
- *   1. Use sigwaitinfo(), sigemptyset(), sigaddset(), sigprocmask() to
- *      put threads into sleep until the mutex holder wakes up
- *   2. Use pthread_self() to get the pthread_t instance of the calling thread.
- *   3. Manage the threads that are waiting for the mutex instance using
- *      a custom data structure containing the pthread_t and list_head.
- *      However, you may need to use a spinlock to prevent the race condition
- *      on the waiter list (i.e., multiple waiters are being inserted into the 
- *      waiting list simultaneously, one waiters are going into the waiter list
- *      and the mutex holder tries to remove a waiter from the list, etc..)
+ * Each side also keeps the index of the other side it has seen last, and
+ * reads the published index of the other side only when the buffer looks
+ * full or empty with the cached one. While the buffer is neither full nor
+ * empty, a side touches only its own lines and the slots.
+ *
+ * A thread parks on the index of the other side, after releasing the
+ * mutex of its side, when the buffer is really full or empty. The other
+ * side wakes up as many of them as the slots it has published, as in the
+ * lock-free mode.
+ *********************************************************************/
+static bool __validate_padded_producer(void *arg)
+{
+	long pos = (long)arg;
+
+	fetch_and_add(&ringbuffer.emptied.nr_parked, 1);
+	if (pos - READ_ONCE(ringbuffer.emptied.published) < ringbuffer.nr_slots) {
+		fetch_and_add(&ringbuffer.emptied.nr_parked, -1);
+		return false;
+	}
+	return true;
+}
+
+static bool __validate_padded_consumer(void *arg)
+{
+	long pos = (long)arg;
+
+	fetch_and_add(&ringbuffer.filled.nr_parked, 1);
+	if (READ_ONCE(ringbuffer.filled.published) != pos) {
+		fetch_and_add(&ringbuffer.filled.nr_parked, -1);
+		return false;
+	}
+	return true;
+}
+
+static void __unparked_padded(void *arg, struct wait_record *waiter)
+{
+	int *nr_parked = arg;
+
+	if (waiter) fetch_and_add(nr_parked, -1);
+}
+
+/**
+ * Put @values into up to @max slots. The index is published under the
+ * mutex so that it never goes backward, and the consumers are woken up
+ * after releasing the mutex. Return the number of the values enqueued
  */
+static int __enqueue_many_padded(const int values[], int max)
+{
+	struct ring_side *side = &ringbuffer.producer;
+	long pos;
+	long nr;
 
-void acquire_mutex(struct mutex *mutex)
-{	
-	acquire_spinlock(&mutex->spinlock);
+	for (;;) {
+		acquire_mutex(&side->lock);
+		pos = side->index;
 
-	if(--mutex->key >= 0){
-		release_spinlock(&mutex->spinlock);
-		return;
+		if ((nr = ringbuffer.nr_slots - (pos - side->cached)) == 0) {
+			/* Looks full. See how far the consumers have gone */
+			side->cached = READ_ONCE(ringbuffer.emptied.published);
+			nr = ringbuffer.nr_slots - (pos - side->cached);
+		}
+		if (nr) break;
+
+		release_mutex(&side->lock);
+		park(&ringbuffer.emptied, __validate_padded_producer, (void *)pos);
 	}
-	sigset_t set;
-	sigemptyset(&set);
-	sigaddset(&set, SIGINT);
-	sigprocmask(SIG_BLOCK, &set, NULL);
+	if (nr > max) nr = max;
 
-	struct thread t;
-	t.pthread = pthread_self();
+	__copy_into_slots(ringbuffer.slots, ringbuffer.nr_slots,
+			pos % ringbuffer.nr_slots, values, nr);
+	barrier();
+	side->index = pos + nr;
+	WRITE_ONCE(ringbuffer.filled.published, pos + nr);
+	release_mutex(&side->lock);
 
-	list_add_tail(&t.list, &mutex->waitqueue);
-	release_spinlock(&mutex->spinlock);
-	sigwaitinfo(&set, NULL);
-	return;
+	__unpark_many(&ringbuffer.filled, &ringbuffer.filled.nr_parked, nr,
+			__unparked_padded);
+	return nr;
+}
+
+static int __dequeue_many_padded(int values[], int max)
+{
+	struct ring_side *side = &ringbuffer.consumer;
+	long pos;
+	long nr;
+
+	for (;;) {
+		acquire_mutex(&side->lock);
+		pos = side->index;
+
+		if ((nr = side->cached - pos) == 0) {
+			/* Looks empty. See how far the producers have gone */
+			side->cached = READ_ONCE(ringbuffer.filled.published);
+			nr = side->cached - pos;
+		}
+		if (nr) break;
+
+		release_mutex(&side->lock);
+		park(&ringbuffer.filled, __validate_padded_consumer, (void *)pos);
+	}
+	if (nr > max) nr = max;
+
+	barrier();
+	__copy_from_slots(ringbuffer.slots, ringbuffer.nr_slots,
+			pos % ringbuffer.nr_slots, values, nr);
+	barrier();
+	side->index = pos + nr;
+	WRITE_ONCE(ringbuffer.emptied.published, pos + nr);
+	release_mutex(&side->lock);
+
+	__unpark_many(&ringbuffer.emptied, &ringbuffer.emptied.nr_parked, nr,
+			__unparked_padded);
+	return nr;
 }
 
 
 /*********************************************************************
- * release_mutex(@mutex)
+ * Ring buffer on condition variables
  *
- * DESCRIPTION
- *   Release the mutex held by the calling thread.
+ * @mutex guards the slots, @in, @out, and @nr_filled, and the threads
+ * finding the buffer full or empty wait on @not_full or @not_empty. The
+ * condition variables are signaled only when the buffer turns from empty
+ * to non-empty or from full to non-full, instead of every operation
+ * releasing a semaphore. A woken thread that leaves values or free slots
+ * behind passes the signal on to the next waiter on the same side, so
+ * that no waiter sleeps while the buffer can serve it.
  *
- * HINT
- *   1. Use pthread_kill() to wake up a waiter thread
- *   2. Be careful to prevent race conditions while accessing the waiter list
+ * @nr_ringbuffer_wakeups counts the signals sent to the waiters, and
+ * @nr_ringbuffer_wakeups_saved counts the operations done with a waiter on
+ * the other side but no signal sent, each of which would wake up a waiter
+ * if every operation signaled.
+ *********************************************************************/
+unsigned long nr_ringbuffer_wakeups = 0;
+unsigned long nr_ringbuffer_wakeups_saved = 0;
+
+/**
+ * Signal @cond if @signal, or count it saved, when any thread waits on it.
+ * Called with the mutex held
  */
-void release_mutex(struct mutex *mutex)
-{	
+static void __signal_waiter(struct condvar *cond, bool signal)
+{
+	if (!READ_ONCE(cond->nr_waiters)) return;
 
-	acquire_spinlock(&mutex->spinlock);
-	if(++mutex->key > 0){
-		release_spinlock(&mutex->spinlock);
-		return;
+	if (signal) {
+		signal_condvar(cond);
+		nr_ringbuffer_wakeups++;
+	} else {
+		nr_ringbuffer_wakeups_saved++;
 	}
-	struct thread *temp = list_first_entry(&mutex->waitqueue, struct thread, list);
-	list_del(&temp->list);
-	pthread_kill(temp->pthread, SIGINT);
-	release_spinlock(&mutex->spinlock);
-	return;
-}	
+}
 
+static int __enqueue_many_condvar(const int values[], int max)
+{
+	int nr;
+	bool was_empty;
 
+	acquire_mutex(&ringbuffer.mutex);
+	while (ringbuffer.nr_filled == ringbuffer.nr_slots) {
+		wait_condvar(&ringbuffer.not_full, &ringbuffer.mutex);
+	}
 
-/*********************************************************************
- * Ring buffer
- *********************************************************************/
-struct ringbuffer {
-	/** NEVER CHANGE @nr_slots AND @slots ****/
-	/**/ int nr_slots;                     /**/
-	/**/ int *slots;                       /**/
-	/*****************************************/
+	nr = ringbuffer.nr_slots - ringbuffer.nr_filled;
+	if (nr > max) nr = max;
 
-	struct mutex mutex;
-	struct mutex empty;
-	struct mutex full;
+	__copy_into_slots(ringbuffer.slots, ringbuffer.nr_slots,
+			ringbuffer.in, values, nr);
+	ringbuffer.in = (ringbuffer.in + nr) % ringbuffer.nr_slots;
+	was_empty = ringbuffer.nr_filled == 0;
+	ringbuffer.nr_filled += nr;
 
-	int in, out;
-};
+	__signal_waiter(&ringbuffer.not_empty, was_empty);
+	if (ringbuffer.nr_filled < ringbuffer.nr_slots) {
+		/* Slots left. Pass it on to the next producer if any waits */
+		__signal_waiter(&ringbuffer.not_full, true);
+	}
+	release_mutex(&ringbuffer.mutex);
+	return nr;
+}
+
+static int __dequeue_many_condvar(int values[], int max)
+{
+	int nr;
+	bool was_full;
+
+	acquire_mutex(&ringbuffer.mutex);
+	while (ringbuffer.nr_filled == 0) {
+		wait_condvar(&ringbuffer.not_empty, &ringbuffer.mutex);
+	}
+
+	nr = ringbuffer.nr_filled;
+	if (nr > max) nr = max;
+
+	__copy_from_slots(ringbuffer.slots, ringbuffer.nr_slots,
+			ringbuffer.out, values, nr);
+	ringbuffer.out = (ringbuffer.out + nr) % ringbuffer.nr_slots;
+	was_full = ringbuffer.nr_filled == ringbuffer.nr_slots;
+	ringbuffer.nr_filled -= nr;
+
+	__signal_waiter(&ringbuffer.not_full, was_full);
+	if (ringbuffer.nr_filled > 0) {
+		/* Values left. Pass it on to the next consumer if any waits */
+		__signal_waiter(&ringbuffer.not_empty, true);
+	}
+	release_mutex(&ringbuffer.mutex);
+	return nr;
+}
 
-struct ringbuffer ringbuffer = {
-	.in = 0,
-	.out = 0,
-};
 
 /*********************************************************************
  * enqueue_into_ringbuffer(@value)
@@ -215,11 +1621,30 @@ struct ringbuffer ringbuffer = {
  */
 void enqueue_into_ringbuffer(int value)
 {
+	if (ringbuffer.stamps) __enqueued_at = latency_send_time();
+
+	if (ringbuffer.sharded) {
+		__enqueue_many_sharded(&value, 1);
+		return;
+	}
+	if (ringbuffer.lockfree) {
+		__enqueue_many_lockfree(&value, 1);
+		return;
+	}
+	if (ringbuffer.padded) {
+		__enqueue_many_padded(&value, 1);
+		return;
+	}
+	if (ringbuffer.condvar) {
+		__enqueue_many_condvar(&value, 1);
+		return;
+	}
 
 	acquire_mutex(&ringbuffer.full);
 	acquire_mutex(&ringbuffer.mutex);
 	
 	ringbuffer.slots[ringbuffer.in] = value;
+	if (ringbuffer.stamps) __stamp_slots(ringbuffer.slots, ringbuffer.nr_slots, ringbuffer.in, 1);
 	ringbuffer.in = (ringbuffer.in + 1);
 	if(ringbuffer.in >= ringbuffer.nr_slots){
 		ringbuffer.in = 0;
@@ -243,6 +1668,26 @@ void enqueue_into_ringbuffer(int value)
  */
 int dequeue_from_ringbuffer(void)
 {
+	if (ringbuffer.sharded) {
+		int value;
+		__dequeue_many_sharded(&value, 1);
+		return value;
+	}
+	if (ringbuffer.lockfree) {
+		int value;
+		__dequeue_many_lockfree(&value, 1);
+		return value;
+	}
+	if (ringbuffer.padded) {
+		int value;
+		__dequeue_many_padded(&value, 1);
+		return value;
+	}
+	if (ringbuffer.condvar) {
+		int value;
+		__dequeue_many_condvar(&value, 1);
+		return value;
+	}
 	
 
 	acquire_mutex(&ringbuffer.empty);
@@ -250,6 +1695,7 @@ int dequeue_from_ringbuffer(void)
 	
 	int data = 0;
 	data = ringbuffer.slots[ringbuffer.out];
+	if (ringbuffer.stamps) __record_slots(ringbuffer.slots, ringbuffer.nr_slots, ringbuffer.out, 1);
 	ringbuffer.out = (ringbuffer.out + 1);
 	if(ringbuffer.out >= ringbuffer.nr_slots){
 		ringbuffer.out = 0;
@@ -260,6 +1706,99 @@ int dequeue_from_ringbuffer(void)
 }
 
 
+/*********************************************************************
+ * enqueue_many_into_ringbuffer(@values, @nr)
+ *
+ * DESCRIPTION
+ *   Put @nr values in @values into the buffer. The slots are reserved as
+ *   many as available at once, and they are filled and published together.
+ */
+static int __enqueue_many_locked(const int values[], int nr)
+{
+	int nr_reserved = 1;
+
+	acquire_mutex(&ringbuffer.full);
+	while (nr_reserved < nr && __try_acquire_mutex(&ringbuffer.full)) {
+		nr_reserved++;
+	}
+
+	acquire_mutex(&ringbuffer.mutex);
+	__copy_into_slots(ringbuffer.slots, ringbuffer.nr_slots,
+			ringbuffer.in, values, nr_reserved);
+	ringbuffer.in = (ringbuffer.in + nr_reserved) % ringbuffer.nr_slots;
+	release_mutex(&ringbuffer.mutex);
+
+	for (int i = 0; i < nr_reserved; i++) {
+		release_mutex(&ringbuffer.empty);
+	}
+	return nr_reserved;
+}
+
+void enqueue_many_into_ringbuffer(const int values[], int nr)
+{
+	if (ringbuffer.stamps) __enqueued_at = latency_send_time();
+
+	while (nr > 0) {
+		int nr_enqueued;
+
+		if (ringbuffer.sharded) {
+			nr_enqueued = __enqueue_many_sharded(values, nr);
+		} else if (ringbuffer.lockfree) {
+			nr_enqueued = __enqueue_many_lockfree(values, nr);
+		} else if (ringbuffer.padded) {
+			nr_enqueued = __enqueue_many_padded(values, nr);
+		} else if (ringbuffer.condvar) {
+			nr_enqueued = __enqueue_many_condvar(values, nr);
+		} else {
+			nr_enqueued = __enqueue_many_locked(values, nr);
+		}
+		values += nr_enqueued;
+		nr -= nr_enqueued;
+	}
+}
+
+
+/*********************************************************************
+ * dequeue_many_from_ringbuffer(@values, @max)
+ *
+ * DESCRIPTION
+ *   Take out up to @max values from the buffer into @values. Wait until
+ *   a value is available, and take the others only when they are there.
+ *
+ * RETURN
+ *   Return the number of the values taken out.
+ */
+static int __dequeue_many_locked(int values[], int max)
+{
+	int nr = 1;
+
+	acquire_mutex(&ringbuffer.empty);
+	while (nr < max && __try_acquire_mutex(&ringbuffer.empty)) {
+		nr++;
+	}
+
+	acquire_mutex(&ringbuffer.mutex);
+	__copy_from_slots(ringbuffer.slots, ringbuffer.nr_slots,
+			ringbuffer.out, values, nr);
+	ringbuffer.out = (ringbuffer.out + nr) % ringbuffer.nr_slots;
+	release_mutex(&ringbuffer.mutex);
+
+	for (int i = 0; i < nr; i++) {
+		release_mutex(&ringbuffer.full);
+	}
+	return nr;
+}
+
+int dequeue_many_from_ringbuffer(int values[], int max)
+{
+	if (ringbuffer.sharded) return __dequeue_many_sharded(values, max);
+	if (ringbuffer.lockfree) return __dequeue_many_lockfree(values, max);
+	if (ringbuffer.padded) return __dequeue_many_padded(values, max);
+	if (ringbuffer.condvar) return __dequeue_many_condvar(values, max);
+	return __dequeue_many_locked(values, max);
+}
+
+
 /*********************************************************************
  * fini_ringbuffer
  *
@@ -269,6 +1808,9 @@ int dequeue_from_ringbuffer(void)
 void fini_ringbuffer(void)
 {
 	free(ringbuffer.slots);
+	free(ringbuffer.seqs);
+	free(ringbuffer.shards);
+	free(ringbuffer.stamps);
 }
 
 /*********************************************************************
@@ -287,10 +1829,93 @@ int init_ringbuffer(const int nr_slots)
 	/**/ ringbuffer.nr_slots = nr_slots;                     /**/
 	/**/ ringbuffer.slots = malloc(sizeof(int) * nr_slots);  /**/
 	/***********************************************************/
-	init_mutex(&ringbuffer.mutex);
-	init_mutex(&ringbuffer.empty);
-	init_mutex(&ringbuffer.full);
+	if (adaptive_mutex) {
+		init_adaptive_mutex(&ringbuffer.mutex);
+		init_adaptive_mutex(&ringbuffer.empty);
+		init_adaptive_mutex(&ringbuffer.full);
+	} else {
+		init_mutex(&ringbuffer.mutex);
+		init_mutex(&ringbuffer.empty);
+		init_mutex(&ringbuffer.full);
+	}
+	name_lock_stat(&ringbuffer.mutex, "ring.mutex");
+	name_lock_stat(&ringbuffer.empty, "ring.empty");
+	name_lock_stat(&ringbuffer.full, "ring.full");
+	ringbuffer.in = ringbuffer.out = 0;
+	ringbuffer.stamps = measure_latency ? malloc(sizeof(*ringbuffer.stamps) * nr_slots) : NULL;
 	ringbuffer.empty.key = 0;
 	ringbuffer.full.key = nr_slots-1;
+
+	ringbuffer.lockfree = lockfree_ringbuffer;
+	ringbuffer.seqs = NULL;
+	if (lockfree_ringbuffer) {
+		/* A filled slot and an empty one look the same with one slot */
+		if (nr_slots < 2) {
+			fprintf(stderr, "The lock-free ring buffer needs two or more slots\n");
+			return -EINVAL;
+		}
+		ringbuffer.seqs = malloc(sizeof(*ringbuffer.seqs) * nr_slots);
+		for (int i = 0; i < nr_slots; i++) {
+			ringbuffer.seqs[i] = i;
+		}
+		ringbuffer.head = ringbuffer.tail = 0;
+		ringbuffer.single_consumer = nr_counters == 1;
+		ringbuffer.nr_parked_producers = 0;
+		ringbuffer.nr_parked_consumers = 0;
+	}
+
+	ringbuffer.sharded = sharded_ringbuffer;
+	ringbuffer.shards = NULL;
+	if (sharded_ringbuffer) {
+		void *shards;
+
+		if (nr_slots < nr_generators || nr_counters > 1) {
+			fprintf(stderr, "The sharded ring buffer needs a slot per generator "
+					"and only one counter\n");
+			return -EINVAL;
+		}
+		if (posix_memalign(&shards, 64, sizeof(struct shard) * nr_generators)) {
+			return -ENOMEM;
+		}
+		ringbuffer.shards = shards;
+		ringbuffer.nr_shards = nr_generators;
+
+		/* Split the slots evenly to the shards */
+		for (int i = 0; i < nr_generators; i++) {
+			struct shard *shard = ringbuffer.shards + i;
+			shard->first = nr_slots * i / nr_generators;
+			shard->size = nr_slots * (i + 1) / nr_generators - shard->first;
+			shard->head = shard->tail = 0;
+			shard->producer_parked = 0;
+		}
+		ringbuffer.nr_shards_taken = 0;
+		ringbuffer.next_shard = 0;
+		ringbuffer.consumer_parked = 0;
+	}
+
+	ringbuffer.padded = padded_ringbuffer;
+	if (padded_ringbuffer) {
+		if (adaptive_mutex) {
+			init_adaptive_mutex(&ringbuffer.producer.lock);
+			init_adaptive_mutex(&ringbuffer.consumer.lock);
+		} else {
+			init_mutex(&ringbuffer.producer.lock);
+			init_mutex(&ringbuffer.consumer.lock);
+		}
+		name_lock_stat(&ringbuffer.producer.lock, "ring.producer");
+		name_lock_stat(&ringbuffer.consumer.lock, "ring.consumer");
+		ringbuffer.producer.index = ringbuffer.producer.cached = 0;
+		ringbuffer.consumer.index = ringbuffer.consumer.cached = 0;
+		ringbuffer.filled.published = ringbuffer.emptied.published = 0;
+		ringbuffer.filled.nr_parked = ringbuffer.emptied.nr_parked = 0;
+	}
+
+	ringbuffer.condvar = condvar_ringbuffer;
+	if (condvar_ringbuffer) {
+		init_condvar(&ringbuffer.not_empty);
+		init_condvar(&ringbuffer.not_full);
+		ringbuffer.nr_filled = 0;
+		nr_ringbuffer_wakeups = nr_ringbuffer_wakeups_saved = 0;
+	}
 	return 0;
 }
@@ -0,0 +1,238 @@
+/**********************************************************************
+ * Copyright (c) 2020
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/eventfd.h>
+
+#include "types.h"
+#include "atomic.h"
+#include "list_head.h"
+#include "parking.h"
+
+/*********************************************************************
+ * Hashed wait queues
+ *
+ * A bucket holds the wait queues of all the addresses hashed into it, in
+ * the parking order. The buckets are padded to their own cache lines so
+ * that the locks hashed into different buckets do not share a line.
+ *********************************************************************/
+#define NR_BUCKETS	64
+
+struct bucket {
+	int lock;
+	struct list_head waiters;
+} __attribute__((aligned(64)));
+
+static struct bucket buckets[NR_BUCKETS];
+static int buckets_initialized = 0;
+
+static struct bucket *__get_bucket(void *address)
+{
+	uintptr_t hash = (uintptr_t)address;
+
+	/* Fold the address; the low bits are mostly zero by the alignment */
+	hash ^= hash >> 6;
+	hash ^= hash >> 12;
+	return buckets + (hash % NR_BUCKETS);
+}
+
+static void __lock_bucket(struct bucket *bucket)
+{
+	while (compare_and_swap(&bucket->lock, 0, 1)) {
+		while (READ_ONCE(bucket->lock)) {
+			cpu_relax();
+		}
+	}
+}
+
+static void __unlock_bucket(struct bucket *bucket)
+{
+	barrier();
+	WRITE_ONCE(bucket->lock, 0);
+}
+
+static void __init_buckets(void)
+{
+	/* The first thread sets up the buckets; the others wait for it */
+	if (compare_and_swap(&buckets_initialized, 0, 1) == 0) {
+		for (int i = 0; i < NR_BUCKETS; i++) {
+			buckets[i].lock = 0;
+			INIT_LIST_HEAD(&buckets[i].waiters);
+		}
+		WRITE_ONCE(buckets_initialized, 2);
+	}
+	while (READ_ONCE(buckets_initialized) != 2) {
+		cpu_relax();
+	}
+}
+
+
+/*********************************************************************
+ * Wait records
+ *
+ * The records are never freed; a lock may keep the record of its owner
+ * to see whether the owner is parked even after the owner exits.
+ *********************************************************************/
+static __thread struct wait_record *__self = NULL;
+
+struct wait_record *current_wait_record(void)
+{
+	if (!__self) {
+		__init_buckets();
+
+		__self = malloc(sizeof(*__self));
+		__self->eventfd = eventfd(0, 0);
+		assert(__self->eventfd >= 0);
+		__self->address = NULL;
+		__self->parked = 0;
+		INIT_LIST_HEAD(&__self->list);
+	}
+	return __self;
+}
+
+static void __sleep(struct wait_record *record)
+{
+	uint64_t count;
+
+	while (read(record->eventfd, &count, sizeof(count)) != sizeof(count)) {
+		assert(errno == EINTR);
+	}
+}
+
+static void __wake_up(struct wait_record *record)
+{
+	uint64_t count = 1;
+
+	while (write(record->eventfd, &count, sizeof(count)) != sizeof(count)) {
+		assert(errno == EINTR);
+	}
+}
+
+
+/*********************************************************************
+ * Park and unpark
+ *********************************************************************/
+bool park(void *address, bool (*validate)(void *), void *arg)
+{
+	struct wait_record *self = current_wait_record();
+	struct bucket *bucket = __get_bucket(address);
+
+	__lock_bucket(bucket);
+	if (validate && !validate(arg)) {
+		__unlock_bucket(bucket);
+		return false;
+	}
+	self->address = address;
+	WRITE_ONCE(self->parked, 1);
+	list_add_tail(&self->list, &bucket->waiters);
+	__unlock_bucket(bucket);
+
+	__sleep(self);
+
+	WRITE_ONCE(self->parked, 0);
+	return true;
+}
+
+bool unpark_one(void *address, void (*callback)(void *, struct wait_record *), void *arg)
+{
+	struct bucket *bucket;
+	struct wait_record *record;
+	struct wait_record *target = NULL;
+
+	current_wait_record();	/* To initialize the buckets */
+	bucket = __get_bucket(address);
+
+	__lock_bucket(bucket);
+	list_for_each_entry(record, &bucket->waiters, list) {
+		if (record->address == address) {
+			target = record;
+			break;
+		}
+	}
+	if (target) list_del_init(&target->list);
+	if (callback) callback(arg, target);
+	__unlock_bucket(bucket);
+
+	if (target) __wake_up(target);
+	return target != NULL;
+}
+
+int unpark_all(void *address)
+{
+	struct bucket *bucket;
+	struct wait_record *record, *tmp;
+	LIST_HEAD(unparked);
+	int nr_unparked = 0;
+
+	current_wait_record();
+	bucket = __get_bucket(address);
+
+	__lock_bucket(bucket);
+	list_for_each_entry_safe(record, tmp, &bucket->waiters, list) {
+		if (record->address != address) continue;
+		list_move_tail(&record->list, &unparked);
+	}
+	__unlock_bucket(bucket);
+
+	/* Nobody else touches the records until they are woken up */
+	list_for_each_entry_safe(record, tmp, &unparked, list) {
+		list_del_init(&record->list);
+		__wake_up(record);
+		nr_unparked++;
+	}
+	return nr_unparked;
+}
+
+int requeue(void *from, void *to, int nr,
+		void (*callback)(void *, struct wait_record *), void *arg)
+{
+	struct bucket *src, *dst;
+	struct wait_record *record, *tmp;
+	int nr_requeued = 0;
+
+	current_wait_record();
+	src = __get_bucket(from);
+	dst = __get_bucket(to);
+
+	/* Lock the buckets in the order of their addresses not to deadlock */
+	if (src == dst) {
+		__lock_bucket(src);
+	} else if (src < dst) {
+		__lock_bucket(src);
+		__lock_bucket(dst);
+	} else {
+		__lock_bucket(dst);
+		__lock_bucket(src);
+	}
+
+	list_for_each_entry_safe(record, tmp, &src->waiters, list) {
+		if (nr_requeued == nr) break;
+		if (record->address != from) continue;
+
+		record->address = to;
+		list_move_tail(&record->list, &dst->waiters);
+		if (callback) callback(arg, record);
+		nr_requeued++;
+	}
+
+	if (src != dst) __unlock_bucket(dst);
+	__unlock_bucket(src);
+	return nr_requeued;
+}
@@ -0,0 +1,84 @@
+/**********************************************************************
+ * Copyright (c) 2020
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __PARKING_H__
+#define __PARKING_H__
+
+#include "list_head.h"
+
+/*************************************************
+ * Parking lot
+ *
+ * Threads park on an address, usually the address of a lock, and sleep
+ * until another thread unparks them from the address. The waiting threads
+ * are kept in a hashed table of wait queues keyed by the address so that
+ * the locks need no waitqueue of their own.
+ */
+
+/**
+ * Per-thread wait record. A thread has one for its lifetime.
+ */
+struct wait_record {
+	int eventfd;			/* The thread sleeps reading this */
+	void *address;			/* Address parked on */
+	struct list_head list;	/* Entry in the wait queue of the bucket */
+	int parked;				/* Waiting for an unpark */
+};
+
+/**
+ * Return the wait record of the calling thread
+ */
+struct wait_record *current_wait_record(void);
+
+/**
+ * Park the calling thread on @address. @validate is called with @arg while
+ * the wait queue of @address is locked, and the thread parks only if it
+ * returns true; an unpark cannot slip in between the validation and
+ * the parking. @validate may be NULL to park unconditionally.
+ *
+ * Return true if the thread has parked and got unparked, false if
+ * @validate told not to park.
+ */
+bool park(void *address, bool (*validate)(void *), void *arg);
+
+/**
+ * Unpark the thread parked on @address first. @callback, if not NULL, is
+ * called with @arg and the wait record of the thread to unpark (NULL if
+ * none is parked) while the wait queue of @address is locked.
+ *
+ * Return true if a thread is unparked.
+ */
+bool unpark_one(void *address, void (*callback)(void *, struct wait_record *), void *arg);
+
+/**
+ * Unpark all the threads parked on @address.
+ * Return the number of the threads unparked.
+ */
+int unpark_all(void *address);
+
+/**
+ * Move up to @nr threads parked on @address @from to @to in the parking
+ * order without waking them up; they get unparked from @to later. @callback,
+ * if not NULL, is called with @arg and the wait record of each thread moved
+ * while the wait queues of both addresses are locked. The record keeps the
+ * address it is parked on last, so the thread can tell where it is unparked
+ * from.
+ *
+ * Return the number of the threads moved.
+ */
+int requeue(void *from, void *to, int nr,
+		void (*callback)(void *, struct wait_record *), void *arg);
+
+#endif
@@ -19,9 +19,14 @@
 #include <pthread.h>
 #include <assert.h>
 #include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
 
 #include "types.h"
 #include "locks.h"
+#include "atomic.h"
+#include "histogram.h"
 
 #include <sys/time.h>
 #include <sys/resource.h>
@@ -33,45 +38,81 @@ static int testlock_held = 0;
 static enum lock_types lock_type;
 
 static int nr_tested = 0;
-static int testing_duration_sec = 5;
+int testing_duration_sec = 5;
+
+int nr_testers = 4;
+bool test_performance_only = false;
+
+/* Lock primitives to test */
+struct lock_ops {
+	const char *name;
+	void (*init)(void *);
+	void (*acquire)(void *);
+	void (*release)(void *);
+	bool busywaiting;	/* Expected to busy-wait for the lock */
+	bool in_order;		/* Expected to grant the lock in the requesting order */
+};
+
+#define LOCK_OPS(_name_, _type_, _busywaiting_, _in_order_) { \
+	.name = _name_, \
+	.init = (void (*)(void *))init_##_type_, \
+	.acquire = (void (*)(void *))acquire_##_type_, \
+	.release = (void (*)(void *))release_##_type_, \
+	.busywaiting = _busywaiting_, \
+	.in_order = _in_order_, \
+}
 
-const int nr_testers = 4;
+static struct lock_ops lock_ops[NR_LOCK_TYPES] = {
+	[lock_spinlock] = LOCK_OPS("spinlock", spinlock, true, false),
+	[lock_mutex] = LOCK_OPS("mutex", mutex, false, true),
+	[lock_ticketlock] = LOCK_OPS("ticket", ticketlock, true, true),
+	[lock_ttaslock] = LOCK_OPS("ttas", ttaslock, true, false),
+	[lock_mcslock] = LOCK_OPS("mcs", mcslock, true, true),
+	[lock_clhlock] = LOCK_OPS("clh", clhlock, true, true),
+	[lock_adaptive_mutex] = LOCK_OPS("adaptive", adaptive_mutex, false, false),
+	[lock_cohortlock] = LOCK_OPS("cohort", cohortlock, true, false),
+};
+
+/**
+ * Return the lock type named @name, or -1 if there is no such lock
+ */
+int find_lock_type(const char *name)
+{
+	for (int i = 0; i < NR_LOCK_TYPES; i++) {
+		if (lock_ops[i].name && strcmp(lock_ops[i].name, name) == 0) return i;
+	}
+	return -1;
+}
+
+/**
+ * Print the names of the lock types available
+ */
+void print_lock_types(void)
+{
+	for (int i = 0; i < NR_LOCK_TYPES; i++) {
+		if (lock_ops[i].name) printf(" %s", lock_ops[i].name);
+	}
+}
 
 /* Wrapper functions to locks */
 static inline const char *__lock_type(void)
 {
-	if (lock_type == lock_spinlock) {
-		return "spinlock";
-	} else if (lock_type == lock_mutex) {
-		return "mutex";
-	}
+	return lock_ops[lock_type].name;
 }
 
 static inline void __lock(void)
 {
-	if (lock_type == lock_spinlock) {
-		acquire_spinlock(testlock);
-	} else if (lock_type == lock_mutex) {
-		acquire_mutex(testlock);
-	}
+	lock_ops[lock_type].acquire(testlock);
 }
 
 static inline void __unlock(void)
 {
-	if (lock_type == lock_spinlock) {
-		release_spinlock(testlock);
-	} else if (lock_type == lock_mutex) {
-		release_mutex(testlock);
-	}
+	lock_ops[lock_type].release(testlock);
 }
 
 static inline void __init_lock(void)
 {
-	if (lock_type == lock_spinlock) {
-		init_spinlock(testlock);
-	} else if (lock_type == lock_mutex) {
-		init_mutex(testlock);
-	}
+	lock_ops[lock_type].init(testlock);
 }
 
 
@@ -80,6 +121,24 @@ static int progress = 0;
 static bool lock_in_order = true;
 static bool keep_testing = true;
 
+/* Time from a release to the acquisition by another tester */
+static struct timespec released_at;
+static long released_by = -1;
+static double handoff_usec = 0;
+static unsigned long nr_handoffs = 0;
+
+static void __account_handoff(long id)
+{
+	struct timespec now;
+
+	if (released_by < 0 || released_by == id) return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	handoff_usec += (now.tv_sec - released_at.tv_sec) * 1e6 +
+			(now.tv_nsec - released_at.tv_nsec) / 1e3;
+	nr_handoffs++;
+}
+
 static void *test_thread(void *_arg_)
 {
 	long id = (long)_arg_;
@@ -91,6 +150,7 @@ static void *test_thread(void *_arg_)
 
 		assert(testlock_held == 0);
 		testlock_held = 1;
+		__account_handoff(id);
 		if (hold_duration_usec) usleep(hold_duration_usec);
 
 		nr_tested++;
@@ -99,9 +159,12 @@ static void *test_thread(void *_arg_)
 		testlock_held = 0;
 		assert(testlock_held == 0);
 
+		released_by = id;
+		clock_gettime(CLOCK_MONOTONIC, &released_at);
 		__unlock();
 		if (hold_duration_usec) usleep(hold_duration_usec);
 	}
+	if (test_performance_only) return 0;
 
 	/* Do test #5 */
 	pthread_barrier_wait(&barrier);
@@ -134,7 +197,20 @@ static bool is_busywaiting(void)
 	return usage.ru_utime.tv_sec > testing_duration_sec;
 }
 
-void test_lock(enum lock_types _lock_type_)
+/**
+ * Print the handoffs within and across the nodes of the cohort lock
+ */
+static void __print_cohort_handoffs(void)
+{
+	unsigned long nr_local, nr_remote;
+
+	get_cohortlock_handoffs(testlock, &nr_local, &nr_remote);
+	fprintf(stderr, "   Handoffs: %lu local, %lu remote (%.1f%% local)\n",
+			nr_local, nr_remote,
+			nr_local + nr_remote ? 100.0 * nr_local / (nr_local + nr_remote) : 0);
+}
+
+int test_lock(enum lock_types _lock_type_)
 {
 	pthread_t tester[nr_testers];
 	pthread_barrier_init(&barrier, NULL, nr_testers + 1);
@@ -147,8 +223,12 @@ void test_lock(enum lock_types _lock_type_)
 	/**
 	 * We don't know the actual size of the locking primitive object here.
 	 * So, just allocate a big memory, and ask to initialize it as a lock ;-)
+	 * It is aligned to a cache line for the locks padding their fields.
 	 */
-	testlock = malloc(4096);
+	if (posix_memalign(&testlock, 64, 4096)) {
+		fprintf(stderr, "Cannot allocate the lock to test\n");
+		return EXIT_FAILURE;
+	}
 	__init_lock();
 
 	/*********************************************************
@@ -185,6 +265,18 @@ void test_lock(enum lock_types _lock_type_)
 	}
 	__print_message("  [Done]\n");
 	fprintf(stderr, "   Performance: %.1f operations/sec\n", (float)nr_tested / testing_duration_sec);
+	fprintf(stderr, "   Handoff latency: %.2f usec\n",
+			nr_handoffs ? handoff_usec / nr_handoffs : 0);
+	if (lock_type == lock_cohortlock) __print_cohort_handoffs();
+
+	if (test_performance_only) {
+		keep_testing = false;
+		for (int i = 0; i < nr_testers; i++) {
+			pthread_join(tester[i], NULL);
+		}
+		if (measure_latency) print_latencies();
+		return EXIT_SUCCESS;
+	}
 
 	/*********************************************************
 	 * Testing possible-race condition.
@@ -204,8 +296,7 @@ void test_lock(enum lock_types _lock_type_)
 	ret = is_busywaiting();
 	__print_message("             [Done]\n");
 	fprintf(stderr, "   Seem to be a %s lock\n", ret ? "busy-waiting" : "blocking");
-	assert((lock_type == lock_spinlock && ret == true) ||
-		   (lock_type == lock_mutex && ret == false));
+	assert(ret == lock_ops[lock_type].busywaiting);
 
 	keep_testing = false;
 
@@ -219,11 +310,370 @@ void test_lock(enum lock_types _lock_type_)
 		pthread_join(tester[i], NULL);
 	}
 	assert(testlock_held == 0);
-	if (lock_type == lock_spinlock || (lock_type == lock_mutex && lock_in_order)) {
+	if (measure_latency) print_latencies();
+	if (!lock_ops[lock_type].in_order || lock_in_order) {
 		fprintf(stderr, "\n >>>> Congraturations! Your %s implementation looks great!! <<<<\n\n", __lock_type());
 	} else {
-		assert(0 && "wrong lock wait ordering for mutex");
+		assert(0 && "wrong lock wait ordering");
 	}
 
-	return;
+	return EXIT_SUCCESS;
+}
+
+
+/*********************************************************************
+ * Reader-writer lock tester
+ *
+ * Testers read and write a small table under a lock for a while, writing
+ * with the given chance, and the reads per second are compared with those
+ * when the mutex protects the table for the both. A write fills the table
+ * with a new value, and a read checks that the values in the table are all
+ * the same, so that a read overlapping a write is caught.
+ *********************************************************************/
+#define RW_TABLE_SIZE	16
+
+enum rw_types {
+	rw_mutex = 0,
+	rw_rwlock,
+	rw_rwsem,
+	rw_seqlock,
+	NR_RW_TYPES,
+};
+
+struct rw_ops {
+	const char *name;
+	void (*init)(void *);
+	void (*read_lock)(void *);
+	void (*read_unlock)(void *);
+	void (*write_lock)(void *);
+	void (*write_unlock)(void *);
+};
+
+#define RW_OPS(_name_, _init_, _read_lock_, _read_unlock_, _write_lock_, _write_unlock_) { \
+	.name = _name_, \
+	.init = (void (*)(void *))_init_, \
+	.read_lock = (void (*)(void *))_read_lock_, \
+	.read_unlock = (void (*)(void *))_read_unlock_, \
+	.write_lock = (void (*)(void *))_write_lock_, \
+	.write_unlock = (void (*)(void *))_write_unlock_, \
+}
+
+/* Seqlock readers take no lock but retry; see __read_table() */
+static struct rw_ops rw_ops[NR_RW_TYPES] = {
+	[rw_mutex] = RW_OPS("mutex", init_mutex, acquire_mutex, release_mutex,
+			acquire_mutex, release_mutex),
+	[rw_rwlock] = RW_OPS("rwlock", init_rwlock, acquire_rwlock_read, release_rwlock_read,
+			acquire_rwlock_write, release_rwlock_write),
+	[rw_rwsem] = RW_OPS("rwsem", init_rwsem, acquire_rwsem_read, release_rwsem_read,
+			acquire_rwsem_write, release_rwsem_write),
+	[rw_seqlock] = RW_OPS("seqlock", init_seqlock, NULL, NULL,
+			write_seqlock, write_sequnlock),
+};
+
+struct rw_tester {
+	pthread_t thread;
+	unsigned int seed;
+	unsigned long nr_reads;
+	unsigned long nr_torn_reads;	/* Reads that saw a write in progress */
+};
+
+static enum rw_types rw_type;
+static int rw_table[RW_TABLE_SIZE];
+static int rw_writing = 0;
+static int rw_write_percent = 0;
+static unsigned long nr_torn_reads = 0;
+
+static void __read_table(int snapshot[])
+{
+	if (rw_type == rw_seqlock) {
+		unsigned int sequence;
+
+		do {
+			sequence = read_seqbegin(testlock);
+			memcpy(snapshot, rw_table, sizeof(rw_table));
+		} while (read_seqretry(testlock, sequence));
+		return;
+	}
+
+	rw_ops[rw_type].read_lock(testlock);
+	assert(READ_ONCE(rw_writing) == 0);
+	memcpy(snapshot, rw_table, sizeof(rw_table));
+	rw_ops[rw_type].read_unlock(testlock);
+}
+
+static void __write_table(void)
+{
+	rw_ops[rw_type].write_lock(testlock);
+	assert(rw_writing == 0);
+	WRITE_ONCE(rw_writing, 1);
+	for (int i = 0; i < RW_TABLE_SIZE; i++) {
+		WRITE_ONCE(rw_table[i], rw_table[i] + 1);
+	}
+	WRITE_ONCE(rw_writing, 0);
+	rw_ops[rw_type].write_unlock(testlock);
+}
+
+static void *rw_test_thread(void *_arg_)
+{
+	struct rw_tester *self = _arg_;
+	int snapshot[RW_TABLE_SIZE];
+
+	pthread_barrier_wait(&barrier);
+
+	while (READ_ONCE(keep_testing)) {
+		if (rand_r(&self->seed) % 100 < rw_write_percent) {
+			__write_table();
+			continue;
+		}
+		__read_table(snapshot);
+		for (int i = 1; i < RW_TABLE_SIZE; i++) {
+			if (snapshot[i] != snapshot[0]) {
+				self->nr_torn_reads++;
+				break;
+			}
+		}
+		self->nr_reads++;
+	}
+	return 0;
+}
+
+/**
+ * Run @nr_threads testers on the lock of @type for @testing_duration_sec.
+ * Return the reads per second
+ */
+static double __run_rw_test(enum rw_types type, int nr_threads)
+{
+	struct rw_tester testers[nr_threads];
+	unsigned long nr_reads = 0;
+
+	rw_type = type;
+	rw_ops[rw_type].init(testlock);
+	memset(rw_table, 0x00, sizeof(rw_table));
+	keep_testing = true;
+
+	pthread_barrier_init(&barrier, NULL, nr_threads + 1);
+	for (int i = 0; i < nr_threads; i++) {
+		testers[i] = (struct rw_tester) { .seed = i + 1 };
+		pthread_create(&testers[i].thread, NULL, rw_test_thread, testers + i);
+	}
+	pthread_barrier_wait(&barrier);
+	sleep(testing_duration_sec);
+	WRITE_ONCE(keep_testing, false);
+
+	for (int i = 0; i < nr_threads; i++) {
+		pthread_join(testers[i].thread, NULL);
+		nr_reads += testers[i].nr_reads;
+		nr_torn_reads += testers[i].nr_torn_reads;
+	}
+	pthread_barrier_destroy(&barrier);
+
+	return (double)nr_reads / testing_duration_sec;
+}
+
+/**
+ * Test the reader-writer locks with each write percentage in the comma-
+ * separated @percents, doubling the testers from one up to @nr_testers
+ */
+int test_rwlocks(const char *percents)
+{
+	char *buffer = malloc(strlen(percents) + 1);
+	char *token;
+	int nr_runs = 0;
+
+	for (int nr_threads = 1; nr_threads <= nr_testers; nr_threads <<= 1) {
+		nr_runs++;
+	}
+	testlock = malloc(4096);
+	strcpy(buffer, percents);
+
+	for (token = strtok(buffer, ","); token; token = strtok(NULL, ",")) {
+		double performance[NR_RW_TYPES][nr_runs];
+
+		rw_write_percent = atoi(token);
+		if (rw_write_percent < 0 || rw_write_percent > 100) {
+			fprintf(stderr, "Invalid write percentage %s\n", token);
+			free(buffer);
+			return EXIT_FAILURE;
+		}
+
+		printf("Reads/sec with %d%% writes\n", rw_write_percent);
+		printf("%-8s", "Lock");
+		for (int nr_threads = 1; nr_threads <= nr_testers; nr_threads <<= 1) {
+			printf(" %11d threads", nr_threads);
+		}
+		printf("\n");
+
+		for (int i = 0; i < NR_RW_TYPES; i++) {
+			printf("%-8s", rw_ops[i].name);
+			for (int j = 0, nr_threads = 1; j < nr_runs; j++, nr_threads <<= 1) {
+				performance[i][j] = __run_rw_test(i, nr_threads);
+				if (i == rw_mutex) {
+					printf(" %19.1f", performance[i][j]);
+				} else {
+					printf(" %10.1f (%5.2fx)", performance[i][j],
+							performance[rw_mutex][j] ?
+							performance[i][j] / performance[rw_mutex][j] : 0);
+				}
+				fflush(stdout);
+			}
+			printf("\n");
+		}
+		printf("\n");
+	}
+	free(buffer);
+	free(testlock);
+	fflush(stdout);
+
+	if (nr_torn_reads) {
+		fprintf(stderr, ">>> %lu reads saw a table half-written!!! <<<\n", nr_torn_reads);
+		return EXIT_FAILURE;
+	}
+	fprintf(stderr, ">>> No read saw a table half-written <<<\n");
+	return EXIT_SUCCESS;
+}
+
+
+/*********************************************************************
+ * Lock benchmark
+ *
+ * Sweep the lock types, the number of threads, the length of the critical
+ * section, and the think time between the critical sections. Each point is
+ * measured after a warmup trial for @nr_trials trials of @BENCH_TRIAL_MSEC,
+ * and the mean and the standard deviation of the operations per second are
+ * written as a CSV line. The critical section and the think time are given
+ * in iterations of an empty loop, not in time, so that they do not involve
+ * the scheduler as usleep() does.
+ *********************************************************************/
+#define BENCH_TRIAL_MSEC	100
+
+static const int bench_cs_lengths[] = { 0, 100, 1000 };
+static const int bench_think_times[] = { 0, 1000 };
+#define NR_BENCH_CS_LENGTHS		((int)(sizeof(bench_cs_lengths) / sizeof(*bench_cs_lengths)))
+#define NR_BENCH_THINK_TIMES	((int)(sizeof(bench_think_times) / sizeof(*bench_think_times)))
+
+struct bench_thread {
+	pthread_t thread;
+	unsigned long nr_ops;
+} __attribute__((aligned(64)));
+
+static int bench_cs_length;
+static int bench_think_time;
+
+static void __work(int iterations)
+{
+	for (int i = 0; i < iterations; i++) {
+		barrier();
+	}
+}
+
+static void *bench_thread(void *_arg_)
+{
+	struct bench_thread *self = _arg_;
+
+	pthread_barrier_wait(&barrier);
+
+	while (READ_ONCE(keep_testing)) {
+		__lock();
+		__work(bench_cs_length);
+		__unlock();
+		__work(bench_think_time);
+		self->nr_ops++;
+	}
+	return 0;
+}
+
+/**
+ * Run @nr_threads threads on the lock for a trial. Return the operations
+ * per second
+ */
+static double __run_lock_trial(int nr_threads)
+{
+	struct bench_thread threads[nr_threads];
+	struct timespec start, end;
+	unsigned long nr_ops = 0;
+
+	__init_lock();
+	keep_testing = true;
+
+	pthread_barrier_init(&barrier, NULL, nr_threads + 1);
+	for (int i = 0; i < nr_threads; i++) {
+		threads[i].nr_ops = 0;
+		pthread_create(&threads[i].thread, NULL, bench_thread, threads + i);
+	}
+	pthread_barrier_wait(&barrier);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	usleep(BENCH_TRIAL_MSEC * 1000);
+	WRITE_ONCE(keep_testing, false);
+
+	for (int i = 0; i < nr_threads; i++) {
+		pthread_join(threads[i].thread, NULL);
+		nr_ops += threads[i].nr_ops;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	pthread_barrier_destroy(&barrier);
+
+	return nr_ops / ((end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+/**
+ * Put the mean and the standard deviation of @nr @samples into @mean and
+ * @stddev
+ */
+void summarize_trials(const double samples[], int nr, double *mean, double *stddev)
+{
+	double sum = 0, squares = 0;
+
+	for (int i = 0; i < nr; i++) {
+		sum += samples[i];
+	}
+	*mean = sum / nr;
+
+	for (int i = 0; i < nr; i++) {
+		squares += (samples[i] - *mean) * (samples[i] - *mean);
+	}
+	*stddev = nr > 1 ? sqrt(squares / (nr - 1)) : 0;
+}
+
+/**
+ * Benchmark the lock of @only, or all the locks if @only is negative, with
+ * 1, 2, 4, ... up to @nr_testers threads, and write the results in @csv
+ */
+int bench_locks(FILE *csv, int only, int nr_trials)
+{
+	double samples[nr_trials];
+
+	if (posix_memalign(&testlock, 64, 4096)) {
+		fprintf(stderr, "Cannot allocate the lock to benchmark\n");
+		return EXIT_FAILURE;
+	}
+
+	fprintf(csv, "lock,threads,cs,think,trials,mean_ops_per_sec,stddev_ops_per_sec\n");
+	for (int type = 0; type < NR_LOCK_TYPES; type++) {
+		if (!lock_ops[type].name || (only >= 0 && type != only)) continue;
+		lock_type = type;
+
+		for (int nr_threads = 1; nr_threads <= nr_testers; nr_threads <<= 1) {
+			for (int i = 0; i < NR_BENCH_CS_LENGTHS; i++) {
+				for (int j = 0; j < NR_BENCH_THINK_TIMES; j++) {
+					double mean, stddev;
+
+					bench_cs_length = bench_cs_lengths[i];
+					bench_think_time = bench_think_times[j];
+
+					__run_lock_trial(nr_threads);	/* Warm up */
+					for (int k = 0; k < nr_trials; k++) {
+						samples[k] = __run_lock_trial(nr_threads);
+					}
+					summarize_trials(samples, nr_trials, &mean, &stddev);
+
+					fprintf(csv, "%s,%d,%d,%d,%d,%.1f,%.1f\n", __lock_type(),
+							nr_threads, bench_cs_length, bench_think_time,
+							nr_trials, mean, stddev);
+					fflush(csv);
+				}
+			}
+		}
+	}
+	free(testlock);
+	return EXIT_SUCCESS;
 }
@@ -0,0 +1,362 @@
+/**********************************************************************
+ * Copyright (c) 2020
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "types.h"
+#include "topology.h"
+
+/*********************************************************************
+ * Topology
+ *
+ * The CPUs are read once, in the order of their packages, cores, and
+ * SMT siblings. @thread is the order of the CPU among the siblings of
+ * its core, and @rank is the order of its core in its package.
+ *********************************************************************/
+#define SYSFS_CPU	"/sys/devices/system/cpu"
+
+struct cpu_info {
+	int cpu;
+	int package;
+	int core;
+	int thread;
+	int rank;
+};
+
+static struct cpu_info cpus[CPU_SETSIZE];
+static int nr_cpus = 0;
+static int nr_packages = 0;
+static int nr_cores = 0;
+
+enum placement_types placement = placement_none;
+
+static const char *placement_names[NR_PLACEMENT_TYPES] = {
+	[placement_none] = "none",
+	[placement_compact] = "compact",
+	[placement_scatter] = "scatter",
+	[placement_smt] = "smt",
+	[placement_cross] = "cross",
+};
+
+/* CPUs assigned to the generators and the counters */
+static int *generator_cpus = NULL;
+static int *counter_cpus = NULL;
+static int nr_generator_cpus = 0;
+static int nr_counter_cpus = 0;
+
+int find_placement(const char *name)
+{
+	for (int i = 0; i < NR_PLACEMENT_TYPES; i++) {
+		if (strcmp(placement_names[i], name) == 0) return i;
+	}
+	return -1;
+}
+
+const char *placement_name(void)
+{
+	return placement_names[placement];
+}
+
+/**
+ * Read an integer from @attr in the topology directory of @cpu. Return
+ * @fallback if it cannot be read
+ */
+static int __read_topology(int cpu, const char *attr, int fallback)
+{
+	char path[128];
+	FILE *fp;
+	int value;
+
+	snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/%s", cpu, attr);
+	if (!(fp = fopen(path, "r"))) return fallback;
+	if (fscanf(fp, "%d", &value) != 1) value = fallback;
+	fclose(fp);
+	return value;
+}
+
+/**
+ * Parse the CPU list in @path, such as "0-3,8-11", into @set
+ */
+static bool __read_cpu_list(const char *path, cpu_set_t *set)
+{
+	FILE *fp;
+	int from, to;
+
+	CPU_ZERO(set);
+	if (!(fp = fopen(path, "r"))) return false;
+
+	while (fscanf(fp, "%d", &from) == 1) {
+		int c = fgetc(fp);
+
+		to = from;
+		if (c == '-') {
+			if (fscanf(fp, "%d", &to) != 1) break;
+			c = fgetc(fp);
+		}
+		for (int cpu = from; cpu <= to && cpu < CPU_SETSIZE; cpu++) {
+			CPU_SET(cpu, set);
+		}
+		if (c != ',') break;
+	}
+	fclose(fp);
+	return true;
+}
+
+static int __compare_cpus(const void *_a_, const void *_b_)
+{
+	const struct cpu_info *a = _a_, *b = _b_;
+
+	if (a->package != b->package) return a->package - b->package;
+	if (a->core != b->core) return a->core - b->core;
+	return a->cpu - b->cpu;
+}
+
+static void __read_cpus(void)
+{
+	cpu_set_t online, allowed;
+
+	if (nr_cpus) return;
+
+	/* Take the CPUs online and allowed for the process, such as by taskset */
+	if (!__read_cpu_list(SYSFS_CPU "/online", &online)) {
+		for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) CPU_SET(cpu, &online);
+	}
+	if (sched_getaffinity(0, sizeof(allowed), &allowed)) {
+		CPU_ZERO(&allowed);
+		CPU_SET(0, &allowed);
+	}
+
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		struct cpu_info *info = cpus + nr_cpus;
+
+		if (!CPU_ISSET(cpu, &online) || !CPU_ISSET(cpu, &allowed)) continue;
+
+		info->cpu = cpu;
+		info->package = __read_topology(cpu, "physical_package_id", 0);
+		info->core = __read_topology(cpu, "core_id", cpu);
+		nr_cpus++;
+	}
+	qsort(cpus, nr_cpus, sizeof(*cpus), __compare_cpus);
+
+	for (int i = 0; i < nr_cpus; i++) {
+		struct cpu_info *info = cpus + i;
+		struct cpu_info *prev = i ? info - 1 : NULL;
+
+		if (!prev || prev->package != info->package) {
+			nr_packages++;
+			info->rank = 0;
+		} else {
+			info->rank = prev->rank + (prev->core != info->core);
+		}
+		if (!prev || prev->package != info->package || prev->core != info->core) {
+			nr_cores++;
+			info->thread = 0;
+		} else {
+			info->thread = prev->thread + 1;
+		}
+	}
+}
+
+
+/*********************************************************************
+ * Placement
+ *
+ * The CPUs are handed out from an ordered list and wrap around when
+ * there are more threads than the CPUs. The generators take the CPUs
+ * first, and then the counters.
+ *
+ * - compact goes through the CPUs in the topology order, so the threads
+ *   share the cores and the packages as much as possible.
+ * - scatter orders the CPUs by their SMT thread, core rank, and package,
+ *   so the threads take their own cores, alternating the packages.
+ * - smt puts the generators on their own cores, and counter i on the SMT
+ *   sibling of the core of generator i. If the core has no sibling, the
+ *   counter takes a core of its own after the cores of the generators
+ *   rather than sharing the CPU of the generator.
+ * - cross puts the generators on the first package and the counters on
+ *   the last one, on the CPUs of the package in the topology order. On a
+ *   single package, the counters take the CPUs from the other end.
+ *********************************************************************/
+static int __compare_scatter(const void *_a_, const void *_b_)
+{
+	const struct cpu_info *a = _a_, *b = _b_;
+
+	if (a->thread != b->thread) return a->thread - b->thread;
+	if (a->rank != b->rank) return a->rank - b->rank;
+	return a->package - b->package;
+}
+
+static void __place_in_order(struct cpu_info *order, int nr)
+{
+	for (int i = 0; i < nr_generator_cpus; i++) {
+		generator_cpus[i] = order[i % nr].cpu;
+	}
+	for (int i = 0; i < nr_counter_cpus; i++) {
+		counter_cpus[i] = order[(nr_generator_cpus + i) % nr].cpu;
+	}
+}
+
+static void __place_smt(void)
+{
+	struct cpu_info *cores[nr_cores];
+	int nr = 0;
+
+	for (int i = 0; i < nr_cpus; i++) {
+		if (cpus[i].thread == 0) cores[nr++] = cpus + i;
+	}
+
+	for (int i = 0; i < nr_generator_cpus; i++) {
+		generator_cpus[i] = cores[i % nr]->cpu;
+	}
+	for (int i = 0; i < nr_counter_cpus; i++) {
+		struct cpu_info *core = cores[i % nr];
+
+		/* The next CPU is the sibling if the core has any */
+		if (core + 1 < cpus + nr_cpus && core[1].thread == 1) {
+			counter_cpus[i] = core[1].cpu;
+		} else {
+			counter_cpus[i] = cores[(nr_generator_cpus + i) % nr]->cpu;
+		}
+	}
+}
+
+static void __place_cross(void)
+{
+	int first = cpus[0].package;
+	int last = cpus[nr_cpus - 1].package;
+	int from = 0, to = nr_cpus - 1;
+	int nr_first = 0;
+
+	while (nr_first < nr_cpus && cpus[nr_first].package == first) nr_first++;
+	if (first != last) {
+		while (cpus[from].package != last) from++;
+	}
+
+	for (int i = 0; i < nr_generator_cpus; i++) {
+		generator_cpus[i] = cpus[i % nr_first].cpu;
+	}
+	for (int i = 0; i < nr_counter_cpus; i++) {
+		if (first != last) {
+			counter_cpus[i] = cpus[from + i % (nr_cpus - from)].cpu;
+		} else {
+			counter_cpus[i] = cpus[to - i % nr_cpus].cpu;
+		}
+	}
+}
+
+int plan_placement(int nr_generators, int nr_counters)
+{
+	free(generator_cpus);
+	free(counter_cpus);
+	generator_cpus = counter_cpus = NULL;
+	nr_generator_cpus = nr_counter_cpus = 0;
+
+	if (placement == placement_none) return 0;
+
+	__read_cpus();
+	if (!nr_cpus) return -1;
+
+	generator_cpus = malloc(sizeof(*generator_cpus) * nr_generators);
+	counter_cpus = malloc(sizeof(*counter_cpus) * nr_counters);
+	nr_generator_cpus = nr_generators;
+	nr_counter_cpus = nr_counters;
+
+	switch (placement) {
+	case placement_compact:
+		__place_in_order(cpus, nr_cpus);
+		break;
+	case placement_scatter: {
+		struct cpu_info order[nr_cpus];
+
+		memcpy(order, cpus, sizeof(*cpus) * nr_cpus);
+		qsort(order, nr_cpus, sizeof(*order), __compare_scatter);
+		__place_in_order(order, nr_cpus);
+		break;
+	}
+	case placement_smt:
+		__place_smt();
+		break;
+	case placement_cross:
+		__place_cross();
+		break;
+	default:
+		assert(0);
+	}
+	return 0;
+}
+
+/**
+ * Pin the calling thread onto @cpu. Exit if it cannot, since the run
+ * would report the placement planned while the thread runs anywhere
+ */
+static void __pin(const char *role, int id, int cpu)
+{
+	cpu_set_t set;
+	int error;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if ((error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set))) {
+		fprintf(stderr, "Cannot pin %s %d onto CPU %d: %s\n",
+				role, id, cpu, strerror(error));
+		exit(EXIT_FAILURE);
+	}
+}
+
+void pin_generator(int id)
+{
+	if (id < nr_generator_cpus) __pin("generator", id, generator_cpus[id]);
+}
+
+void pin_counter(int id)
+{
+	if (id < nr_counter_cpus) __pin("counter", id, counter_cpus[id]);
+}
+
+const char *describe_topology(void)
+{
+	static char description[80];
+
+	__read_cpus();
+	snprintf(description, sizeof(description), "%d packages, %d cores, %d CPUs",
+			nr_packages, nr_cores, nr_cpus);
+	return description;
+}
+
+const char *describe_placement(void)
+{
+	static char *description = NULL;
+	int size = (nr_generator_cpus + nr_counter_cpus) * 16 + 1;
+	int len = 0;
+
+	free(description);
+	description = malloc(size);
+	description[0] = '\0';
+
+	for (int i = 0; i < nr_generator_cpus; i++) {
+		len += snprintf(description + len, size - len, "%sg%d:%d",
+				len ? " " : "", i, generator_cpus[i]);
+	}
+	for (int i = 0; i < nr_counter_cpus; i++) {
+		len += snprintf(description + len, size - len, "%sc%d:%d",
+				len ? " " : "", i, counter_cpus[i]);
+	}
+	return description;
+}
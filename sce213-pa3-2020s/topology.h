@@ -0,0 +1,65 @@
+/**********************************************************************
+ * Copyright (c) 2020
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __TOPOLOGY_H__
+#define __TOPOLOGY_H__
+
+/*************************************************
+ * CPU topology and thread placement
+ *
+ * The CPUs the process may run on are read from /sys/devices/system/cpu
+ * along with their cores and packages (sockets), and the generators and
+ * the counters are pinned onto them by the placement chosen with -A.
+ */
+enum placement_types {
+	placement_none = 0,		/* Leave the threads to the scheduler */
+	placement_compact,		/* Fill the SMT siblings, cores, and packages in order */
+	placement_scatter,		/* Each thread on its own core, round-robin over packages */
+	placement_smt,			/* Each counter on the SMT sibling of a generator */
+	placement_cross,		/* Generators and counters on different packages */
+	NR_PLACEMENT_TYPES,
+};
+
+extern enum placement_types placement;
+
+/**
+ * Return the placement named @name, or -1 if there is no such placement
+ */
+int find_placement(const char *name);
+const char *placement_name(void);
+
+/**
+ * Assign the CPUs to @nr_generators generators and @nr_counters counters
+ * by @placement. Return 0 on success.
+ */
+int plan_placement(int nr_generators, int nr_counters);
+
+/**
+ * Pin the calling thread onto the CPU assigned to the generator or the
+ * counter @id. No-op without a placement. Exit the program if the thread
+ * cannot be pinned.
+ */
+void pin_generator(int id);
+void pin_counter(int id);
+
+/**
+ * Describe the topology, and the CPUs assigned, as "g0:0 g1:2 c0:1".
+ * The description is kept in a static buffer overwritten by the next call,
+ * so call them from one thread only.
+ */
+const char *describe_topology(void);
+const char *describe_placement(void);
+
+#endif
@@ -30,17 +30,42 @@ enum lock_types {
 	lock_spinlock = 0,
 	lock_mutex = 1,
 	lock_semaphore = 2,
+	lock_ticketlock = 3,
+	lock_ttaslock = 4,
+	lock_mcslock = 5,
+	lock_clhlock = 6,
+	lock_adaptive_mutex = 7,
+	lock_cohortlock = 8,
+	NR_LOCK_TYPES,
 };
 
+extern int nr_testers;
+extern int testing_duration_sec;
+extern bool test_performance_only;
+
+extern bool adaptive_mutex;
+extern int mutex_spin_budget;
+extern bool lockfree_ringbuffer;
+extern bool sharded_ringbuffer;
+extern bool padded_ringbuffer;
+extern bool condvar_ringbuffer;
+extern unsigned long nr_ringbuffer_wakeups;
+extern unsigned long nr_ringbuffer_wakeups_saved;
+
 #define MIN_VALUE 0
 #define MAX_VALUE 128
 
 extern int nr_generators;
+extern int nr_counters;
 extern unsigned long nr_generate;
 
 extern int counter_delay_usec;
 extern int generator_delay_usec;
 
+extern int counter_batch;
+extern int generator_batch;
+extern double generator_rate;
+
 #define __print_message(string, args...) \
 	if (verbose) { \
 		printf(string, ##args); \